@@ -1,13 +1,18 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
-// in memory reduces the number of disk reads and also provides
-// a synchronization point for disk blocks used by multiple processes.
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents, keyed by (dev, blockno).
+// Caching disk blocks in memory reduces the number of disk reads
+// and also provides a synchronization point for disk blocks used
+// by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To overlap I/O on several locked buffers, call bstart on
+//     each (or bstartv on all), then bwait on each.
+// * To have a block read in before it is needed, call breadahead;
+//     it returns at once, holding no buffer.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -23,69 +28,170 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 31
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock;   // serializes buffer recycling
   struct buf buf[NBUF];
+  int hand;               // next buf[] to consider recycling
+
+  // Hash table of buffers, keyed by (dev, blockno).
+  // Each bucket's lock protects its chain and the
+  // refcnt and used of the buffers on it.
+  struct {
+    struct spinlock lock;
+    struct buf *head;
+  } bucket[NBUCKET];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Read-ahead statistics.
+  uint nahead;            // blocks started by breadahead()
+  uint nhit;              // of those, later found by bread()
+  uint nmiss;             // bread()s that had to wait for the disk
 } bcache;
 
+static int
+bhash(uint dev, uint blockno)
+{
+  return (dev * 67 + blockno) % NBUCKET;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Every buffer starts out free, holding block 0 of device 0.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.bucket[bhash(0, 0)].head;
+    bcache.bucket[bhash(0, 0)].head = b;
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block (dev, blockno) in its bucket, and if found
+// take a reference to it. Caller must hold the bucket's lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(int id, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bcache.bucket[id].head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer with a reference but
+// unlocked, and set *hit to whether it was already cached.
+// Returns 0 if every buffer is in use.
+static struct buf*
+blookup(uint dev, uint blockno, int *hit)
+{
+  struct buf *b, **pb;
+  int id, i, bid;
+
+  id = bhash(dev, blockno);
+  *hit = 1;
+
+  // Is the block already cached?
+  acquire(&bcache.bucket[id].lock);
+  b = bfind(id, dev, blockno);
+  release(&bcache.bucket[id].lock);
+  if(b)
+    return b;
+
+  // Not cached. Only one process at a time recycles buffers,
+  // so check again: another may have just read this block in.
+  acquire(&bcache.lock);
+  acquire(&bcache.bucket[id].lock);
+  b = bfind(id, dev, blockno);
+  release(&bcache.bucket[id].lock);
+  if(b){
+    release(&bcache.lock);
+    return b;
+  }
+
+  // Recycle an unused buffer, chosen by a clock hand that
+  // sweeps buf[] and passes over, once, each buffer used since
+  // the hand last came by. A buffer only changes chains with
+  // bcache.lock held, so its bucket is known, and the hand
+  // holds one bucket lock at a time.
+  for(i = 0; i < 2*NBUF; i++){
+    b = &bcache.buf[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % NBUF;
+    bid = bhash(b->dev, b->blockno);
+    acquire(&bcache.bucket[bid].lock);
+    if(b->refcnt == 0){
+      if(!b->used)
+        break;
+      b->used = 0;
     }
+    release(&bcache.bucket[bid].lock);
+  }
+  if(i == 2*NBUF){
+    release(&bcache.lock);
+    return 0;
   }
-  panic("bget: no buffers");
+
+  // Take it off its old chain and move it to the new one.
+  for(pb = &bcache.bucket[bid].head; *pb != b; pb = &(*pb)->next)
+    ;
+  *pb = b->next;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->ahead = 0;
+  b->refcnt = 1;
+  release(&bcache.bucket[bid].lock);
+
+  acquire(&bcache.bucket[id].lock);
+  b->next = bcache.bucket[id].head;
+  bcache.bucket[id].head = b;
+  release(&bcache.bucket[id].lock);
+  release(&bcache.lock);
+
+  *hit = 0;
+  return b;
+}
+
+// Drop a reference taken by blookup().
+static void
+bput(struct buf *b)
+{
+  int id;
+
+  id = bhash(b->dev, b->blockno);
+  acquire(&bcache.bucket[id].lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->used = 1;
+  }
+  release(&bcache.bucket[id].lock);
+}
+
+// Return a locked buffer for block on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int hit;
+
+  b = blookup(dev, blockno, &hit);
+  if(b == 0)
+    panic("bget: no buffers");
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,23 +202,115 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
+    __sync_fetch_and_add(&bcache.nmiss, 1);
+    bstart(b, 0);
+    bwait(b);
+  } else if(b->ahead) {
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    b->ahead = 0;
   }
   return b;
 }
 
+// Return a locked buffer for a block whose old contents do
+// not matter, such as a newly allocated one: zero it rather
+// than reading it from the disk.
+struct buf*
+bgetzero(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  b->ahead = 0;
+  return b;
+}
+
+// Start reading block blockno into the cache, and return
+// without waiting, so that a later bread() finds it there.
+// Does nothing if the block is already cached or being read.
+// The disk interrupt handler releases the buffer (see bdone()).
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  int hit;
+
+  b = blookup(dev, blockno, &hit);
+  if(b == 0)
+    return;
+  if(hit){
+    bput(b);
+    return;
+  }
+  acquiresleep(&b->lock);
+  if(b->valid){
+    // another process read it in while we waited for the lock.
+    releasesleep(&b->lock);
+    bput(b);
+    return;
+  }
+  __sync_fetch_and_add(&bcache.nahead, 1);
+  b->ahead = 1;
+  bstart(b, 0);
+}
+
+// Finish a read started by breadahead(): mark the data valid
+// and release the buffer on the reader's behalf.
+// Called from the disk interrupt handler.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
+{
+  bstart(b, 1);
+  bwait(b);
+}
+
+// Start reading (write==0) or writing b's contents, and return
+// without waiting, so that one process can have many blocks in
+// flight. Must be locked, and stay locked until bwait(b).
+void
+bstart(struct buf *b, int write)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bstart");
+  virtio_disk_start(b, write);
+}
+
+// Start I/O on n locked buffers at once, like bstart() on each.
+// If blockno is not 0, bs[i]'s data goes to or comes from
+// block blockno[i] rather than bs[i]'s own block; the cached
+// copy of that block, if any, is not updated.
+void
+bstartv(struct buf **bs, uint *blockno, int n, int write)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bstartv");
+  virtio_disk_startv(bs, blockno, n, write);
+}
+
+// Wait for the I/O that bstart() started on b to finish.
+void
+bwait(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
-    panic("bwrite");
-  virtio_disk_rw(b, 1);
+    panic("bwait");
+  virtio_disk_wait(b);
+  b->valid = 1;
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Mark it used, so that blookup()'s clock hand passes it over once.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +318,31 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int id = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[id].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[id].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int id = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[id].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.bucket[id].lock);
 }
 
-
+// Print read-ahead statistics on the console.
+void
+bstat(void)
+{
+  printf("bcache: %d read ahead, %d hit, %d miss\n",
+         bcache.nahead, bcache.nhit, bcache.nmiss);
+}
@@ -1,12 +1,13 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read by breadahead() and not yet bread()?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int used;    // released since the clock hand last passed
+  struct buf *next; // hash bucket chain
   uchar data[BSIZE];
 };
 
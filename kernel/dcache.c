@@ -0,0 +1,154 @@
+// Directory entry cache.
+//
+// Remembers the results of dirlookup(), keyed by
+// (dev, directory inum, name), so that resolving the same
+// path again does not read the directory. An entry with
+// inum 0 records that the name is not in the directory.
+//
+// The cache is only used and changed with the directory
+// locked, so an entry is correct as long as everything that
+// changes a directory updates it: dirlink() and dirunlink()
+// update the name's entry, and moving entries between
+// blocks or truncating the directory drops all of its
+// entries (see dcacheinval()).
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NDCBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;             // inum of the directory; 0 if this entry is free
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in dir
+  uint off;             // byte offset of name's dirent in dir
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDCACHE];
+  struct dentry *bucket[NDCBUCKET];
+  int hand;             // next eviction candidate
+} dcache;
+
+static struct dentry**
+dcachebucket(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir * 17;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + name[i];
+  return &dcache.bucket[h % NDCBUCKET];
+}
+
+// Find the entry for name in dp.
+// dcache.lock must be held.
+static struct dentry*
+dcachefind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dcachebucket(dp->dev, dp->inum, name); d; d = d->next)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Unlink an entry from its hash chain and free it.
+// dcache.lock must be held.
+static void
+dcachedrop(struct dentry *d)
+{
+  struct dentry **dq;
+
+  for(dq = dcachebucket(d->dev, d->dir, d->name); *dq != d; dq = &(*dq)->next)
+    ;
+  *dq = d->next;
+  d->dir = 0;
+}
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// Look name up in dp. Returns 1 and sets *inum and *off
+// if the cache knows the answer, with *inum 0 if the name
+// is not there; otherwise returns 0.
+// Caller must hold dp->lock.
+int
+dcacheget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int r = 0;
+
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp, name)) != 0){
+    *inum = d->inum;
+    *off = d->off;
+    r = 1;
+  }
+  release(&dcache.lock);
+  return r;
+}
+
+// Remember that name is at off in dp with inode number inum,
+// or, if inum is 0, that it is not in dp.
+// Caller must hold dp->lock.
+void
+dcacheput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **b;
+  int i;
+
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp, name)) == 0){
+    // Use a free entry, or else evict round-robin.
+    for(i = 0; i < NDCACHE; i++){
+      if(dcache.dentry[i].dir == 0){
+        d = &dcache.dentry[i];
+        break;
+      }
+    }
+    if(d == 0){
+      d = &dcache.dentry[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDCACHE;
+      dcachedrop(d);
+    }
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    b = dcachebucket(d->dev, d->dir, d->name);
+    d->next = *b;
+    *b = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget all cached entries of dp, because its entries
+// moved or it is being truncated.
+// Caller must hold dp->lock.
+void
+dcacheinval(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDCACHE]; d++)
+    if(d->dir && d->dev == dp->dev && d->dir == dp->inum)
+      dcachedrop(d);
+  release(&dcache.lock);
+}
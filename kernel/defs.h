@@ -4,18 +4,27 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct seg;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetzero(uint, uint);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstart(struct buf*, int);
+void            bstartv(struct buf**, uint*, int, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bstat(void);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +33,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             loadpage(pagetable_t, struct inode*, struct seg*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,12 +41,19 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepwrite(struct file*, uint64, int n, uint);
+int             filereadv(struct file*, uint64, int);
+int             filewritev(struct file*, uint64, int);
+int             filesplice(struct file*, struct file*, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+int             dirinit(struct inode*);
+void            dirunlink(struct inode*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -63,18 +80,46 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcacheget(struct inode*, char*, uint*, uint*);
+void            dcacheput(struct inode*, char*, uint, uint);
+void            dcacheinval(struct inode*);
+
+// pagecache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint, uint);
+void            pcacheput(struct inode*, uint, uint, char*);
+void            pcacheinval(struct inode*);
+
+// mmap.c
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmabase(struct proc*);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            munmapall(void);
+int             vmafault(pagetable_t, struct vma*, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipereserve(struct pipe*, char**, int);
+void            pipecommit(struct pipe*, int);
+int             pipepeek(struct pipe*, char**, int);
+void            pipeconsume(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -103,9 +148,13 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            schedtick(void);
+void            runqboost(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(void (*)(void), char*);
+int             setaffinity(uint);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -148,6 +197,20 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// timer.c
+void            timertick(void);
+void            timerexact(void);
+int             timerdue(void);
+int             ticksleep(uint);
+void            timerarm(struct timer*, uint);
+void            timersleep(struct timer*);
+void            timercancel(struct timer*);
+uint64          mtime(void);
+int             nanosleep(uint64);
+void            timeridle(void);
+void            timerbusy(void);
+void            timerkick(int);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -165,6 +228,9 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+void            uvmprefault(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -172,6 +238,7 @@ pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
+int             copyuser(pagetable_t, uint64, pagetable_t, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
 // plic.c
@@ -183,6 +250,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_startv(struct buf **, uint *, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,6 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -26,8 +29,10 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg segs[NSEG], *sg;
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -61,15 +66,43 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
-      goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    uint64 sz1;
+    if(nseg == NSEG){
+      // no room to page this one in later; load it now.
+      if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+        goto bad;
+      sz = sz1;
+      if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        goto bad;
+      continue;
+    }
+
+    // Leave the segment to be paged in on first touch, except
+    // for the file-backed part of a writable segment: copyout()
+    // into it must not sleep on the program file, and a read()
+    // of this very file into it would deadlock on ip's lock.
+    sg = &segs[nseg++];
+    sg->vaddr = ph.vaddr;
+    sg->memsz = ph.memsz;
+    sg->off = ph.off;
+    sg->filesz = ph.filesz;
+    sg->perm = flags2perm(ph.flags);
+    if((sg->perm & PTE_W) && ph.filesz > 0){
+      if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.filesz, sg->perm)) == 0)
+        goto bad;
+      sz = sz1;
+      if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        goto bad;
+    }
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep a reference to the program file for demand paging.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -120,13 +153,27 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image; mappings and the
+  // syscall ring do not survive it.
+  munmapall();
+  if(p->ring)
+    kfree((void*)p->ring);
+  p->ring = 0;
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  memmove(p->seg, segs, nseg * sizeof(segs[0]));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,6 +184,11 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
@@ -164,3 +216,54 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   
   return 0;
 }
+
+// Page in the page of segment sg that contains va, reading
+// the part that is backed by the program file ip.
+// Called by uvmfault() on the first touch of the page.
+// Returns 0 on success, -1 on failure.
+int
+loadpage(pagetable_t pagetable, struct inode *ip, struct seg *sg, uint64 va)
+{
+  uint64 a, off;
+  uint n;
+  char *mem;
+  int shared;
+
+  a = PGROUNDDOWN(va);
+  off = a - sg->vaddr;
+  n = 0;
+  if(off < sg->filesz){
+    n = sg->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+
+  // read-only pages are shared with every other process
+  // running this program, through the text page cache.
+  shared = n > 0 && (sg->perm & PTE_W) == 0;
+  if(shared && (mem = pcacheget(ip, sg->off + off, n)) != 0)
+    goto map;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(n > 0){
+    ilock(ip);
+    if(readi(ip, 0, (uint64)mem, sg->off + off, n) != n){
+      iunlock(ip);
+      goto bad;
+    }
+    if(shared)
+      pcacheput(ip, sg->off + off, n, mem);
+    iunlock(ip);
+  }
+
+ map:
+  if(mappages(pagetable, a, PGSIZE, (uint64)mem, sg->perm|PTE_R|PTE_U) != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
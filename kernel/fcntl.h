@@ -3,3 +3,17 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+
+// one buffer of a readv() or writev()
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
@@ -11,8 +11,16 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "proc.h"
 
+// Write a few blocks per log transaction to avoid exceeding
+// the maximum log transaction size, including i-node, indirect
+// blocks, allocation blocks, and 2 blocks of slop for
+// non-aligned writes. This really belongs lower down, since
+// writei() might be writing a device like the console.
+#define MAXOPWRITE (((MAXOPBLOCKS-1-1-2) / 2) * BSIZE)
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -101,10 +109,11 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// Read from file f to addr, a user virtual address if
+// user is set, else a kernel address. An inode is read
+// at *off, which is advanced.
+static int
+fileread1(struct file *f, int user, uint64 addr, int n, uint *off)
 {
   int r = 0;
 
@@ -112,15 +121,23 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    // a device may copy out while holding a spinlock, as
+    // consoleread() does, so it must not fault in file pages.
+    if(user)
+      uvmprefault(myproc()->pagetable, addr, n);
+    r = devsw[f->major].read(user, addr, n);
   } else if(f->type == FD_INODE){
+    // readi() must not fault in pages from a file, which
+    // would lock another inode while holding this one.
+    if(user)
+      uvmprefault(myproc()->pagetable, addr, n);
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    if((r = readi(f->ip, user, addr, *off, n)) > 0)
+      *off += r;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,10 +146,19 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
+{
+  return fileread1(f, 1, addr, n, &f->off);
+}
+
+// Write to file f from addr, a user virtual address if
+// user is set, else a kernel address. An inode is written
+// at *off, which is advanced.
+static int
+filewrite1(struct file *f, int user, uint64 addr, int n, uint *off)
 {
   int r, ret = 0;
 
@@ -140,29 +166,28 @@ filewrite(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // fail at once, rather than after writing up to MAXFILE.
+    if(*off + n < *off || *off + n > MAXFILE*BSIZE)
+      return -1;
+    // writei() must not fault in file pages either.
+    if(user)
+      uvmprefault(myproc()->pagetable, addr, n);
     int i = 0;
     while(i < n){
       int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+      if(n1 > MAXOPWRITE)
+        n1 = MAXOPWRITE;
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      if ((r = writei(f->ip, user, addr + i, *off, n1)) > 0)
+        *off += r;
       iunlock(f->ip);
       end_op();
 
@@ -180,3 +205,191 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return filewrite1(f, 1, addr, n, &f->off);
+}
+
+// Move up to n bytes from fin to fout without copying them
+// through user space. A pipe on either side is drained or
+// filled in place, so data moves between it and the buffer
+// cache (or a device) with a single copy; between two other
+// files it bounces through a kernel page. So does a device
+// feeding a pipe, since a device read may wait indefinitely,
+// and the pipe's writers must not wait on it too.
+// Like fileread(), returns early once the source comes up
+// short, and after one run of buffer from a pipe.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  char *run, *page;
+  int m, r, tot, bounce;
+
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  // a pipe cannot be drained into itself.
+  if(fin->type == FD_PIPE && fout->type == FD_PIPE && fin->pipe == fout->pipe)
+    return -1;
+
+  page = 0;
+  bounce = fin->type != FD_PIPE && (fout->type != FD_PIPE || fin->type == FD_DEVICE);
+  if(bounce && (page = kalloc()) == 0)
+    return -1;
+
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    if(fin->type == FD_PIPE){
+      if((m = pipepeek(fin->pipe, &run, n - tot)) <= 0){
+        r = m;
+        break;
+      }
+      r = filewrite1(fout, 0, (uint64)run, m, &fout->off);
+      pipeconsume(fin->pipe, r > 0 ? r : 0);
+    } else if(!bounce){
+      if((m = pipereserve(fout->pipe, &run, n - tot)) < 0){
+        r = -1;
+        break;
+      }
+      r = fileread1(fin, 0, (uint64)run, m, &fin->off);
+      pipecommit(fout->pipe, r > 0 ? r : 0);
+    } else {
+      m = n - tot < PGSIZE ? n - tot : PGSIZE;
+      r = fileread1(fin, 0, (uint64)page, m, &fin->off);
+      if(r > 0 && filewrite1(fout, 0, (uint64)page, r, &fout->off) != r)
+        r = -1;
+    }
+    if(r <= 0)
+      break;
+    if(r < m || fin->type == FD_PIPE){
+      tot += r;
+      break;
+    }
+  }
+
+  if(page)
+    kfree(page);
+  return tot > 0 ? tot : r;
+}
+
+// Read from file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  return fileread1(f, 1, addr, n, &off);
+}
+
+// Write to file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  return filewrite1(f, 1, addr, n, &off);
+}
+
+// Fetch the i'th entry of the user's iovec array iov.
+static int
+fetchiov(uint64 iov, int i, struct iovec *v)
+{
+  if(copyin(myproc()->pagetable, (char*)v, iov + i*sizeof(*v), sizeof(*v)) < 0)
+    return -1;
+  if(v->iov_len > 0x7fffffff)
+    return -1;
+  return 0;
+}
+
+// Read from file f into the iovcnt buffers described by the
+// user array iov, in order, stopping after a short read. A
+// pipe or device, like read(), returns what one read yields.
+int
+filereadv(struct file *f, uint64 iov, int iovcnt)
+{
+  struct iovec v;
+  int i, r, tot;
+
+  if(iovcnt < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < iovcnt; i++){
+    if(fetchiov(iov, i, &v) < 0 ||
+       (r = fileread1(f, 1, (uint64)v.iov_base, v.iov_len, &f->off)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < v.iov_len || (f->type != FD_INODE && r > 0))
+      break;
+  }
+  return tot;
+}
+
+// Write to file f from the iovcnt buffers described by the
+// user array iov, in order. Returns the bytes written before
+// any error, or -1 if there were none. An inode gets as many
+// buffers per log transaction as fit: they are written back
+// to back, so they touch no more blocks than one write of the
+// same total length.
+int
+filewritev(struct file *f, uint64 iov, int iovcnt)
+{
+  struct iovec v;
+  int i, n, n1, r, room, tot;
+
+  if(f->writable == 0 || iovcnt < 0)
+    return -1;
+
+  tot = 0;
+  if(f->type != FD_INODE){
+    for(i = 0; i < iovcnt; i++){
+      if(fetchiov(iov, i, &v) < 0)
+        break;
+      if((r = filewrite1(f, 1, (uint64)v.iov_base, v.iov_len, &f->off)) > 0)
+        tot += r;
+      if(r != v.iov_len)
+        break;
+    }
+    return i == iovcnt || tot > 0 ? tot : -1;
+  }
+
+  // each iovec, and the buffer it describes, is faulted in
+  // before f->ip is locked, as in filewrite1().
+  room = MAXOPWRITE;
+  begin_op();
+  for(i = 0; i < iovcnt; i++){
+    if(fetchiov(iov, i, &v) < 0)
+      break;
+    uvmprefault(myproc()->pagetable, (uint64)v.iov_base, v.iov_len);
+    ilock(f->ip);
+    for(n = 0; n < v.iov_len; n += r){
+      if(room == 0){
+        iunlock(f->ip);
+        end_op();
+        begin_op();
+        ilock(f->ip);
+        room = MAXOPWRITE;
+      }
+      n1 = v.iov_len - n;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(f->ip, 1, (uint64)v.iov_base + n, f->off, n1)) > 0)
+        f->off += r;
+      if(r != n1){
+        // error from writei
+        iunlock(f->ip);
+        goto out;
+      }
+      room -= r;
+      tot += r;
+    }
+    iunlock(f->ip);
+  }
+ out:
+  end_op();
+  return i == iovcnt || tot > 0 ? tot : -1;
+}
@@ -18,15 +18,22 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash chain
+  struct inode *lprev, *lnext; // LRU list of entries with ref 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int text;           // may have pages in the text page cache
+  uint ranext;        // block after the last one readi() read
+  uint raend;         // block after the last one read ahead
+  uint rawin;         // read-ahead window in blocks; 0 if not sequential
+  uint nextblk;       // where balloc() should look for the next block
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
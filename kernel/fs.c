@@ -22,6 +22,9 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define RAMIN  4   // initial read-ahead window, in blocks
+#define RAMAX  16  // largest read-ahead window
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -37,6 +40,37 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// In-memory summary of the free bitmap, so that balloc() can
+// skip full bitmap blocks, and start looking where a free
+// block is likely rather than at block 0.
+#define NBITMAP (FSSIZE/BPB + 1)
+
+struct {
+  struct spinlock lock;
+  uint nfree[NBITMAP];  // free blocks under each bitmap block
+  uint rotor;           // where to look when there is no goal
+} bsum;
+
+// Count the free blocks under each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int b, bi;
+
+  if(sb.size > NBITMAP * BPB)
+    panic("bsuminit: file system too big");
+  initlock(&bsum.lock, "bsum");
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[b / BPB]++;
+    brelse(bp);
+  }
+  bsum.rotor = sb.size - sb.nblocks;  // first data block
+}
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +78,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -52,36 +87,70 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bgetzero(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Look for a free block in bitmap block bp, which covers
+// blocks b to b+BPB-1, starting at block start.
+// Mark it in use and return it, or return 0 if there is none.
+static uint
+ballocin(struct buf *bp, uint b, uint start)
+{
+  uint bi, m;
+
+  for(bi = start - b; bi < BPB && b + bi < sb.size; bi++){
+    if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+      bi += 7;  // skip a full byte
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0){  // Is block free?
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      return b + bi;
+    }
+  }
+  return 0;
+}
+
+// Allocate a zeroed disk block, as close after goal as
+// possible so that a growing file stays contiguous.
+// If goal is 0, start after the last block allocated.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  uint b, start, addr, nb, i;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  acquire(&bsum.lock);
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor;
+  release(&bsum.lock);
+
+  // Try goal's bitmap block from goal on, then the others
+  // in turn, and finally the start of goal's bitmap block.
+  nb = (sb.size + BPB - 1) / BPB;
+  for(i = 0; i <= nb; i++){
+    b = ((goal / BPB + i) % nb) * BPB;
+    start = i == 0 ? goal : b;
+    if(bsum.nfree[b / BPB] == 0)
+      continue;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
-    }
+    addr = ballocin(bp, b, start);
     brelse(bp);
+    if(addr){
+      acquire(&bsum.lock);
+      bsum.nfree[b / BPB]--;
+      bsum.rotor = addr + 1;
+      release(&bsum.lock);
+      bzero(dev, addr);
+      return addr;
+    }
   }
   printf("balloc: out of blocks\n");
   return 0;
@@ -102,6 +171,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -169,24 +242,95 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// The table is a hash table keyed by (dev, inum). Entries are
+// carved out of pages from kalloc() as the table grows, and are
+// never freed. Entries with ip->ref zero still hold their inode
+// and sit on an LRU list; once the table has NINODE entries,
+// iget() recycles the least recently used of them rather than
+// growing the table further.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 61
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *bucket[NIBUCKET];
+  struct inode *lru;    // unused entries, most recently used first
+  struct inode *lrutail;
+  int ninode;           // entries allocated
 } itable;
 
+static struct inode**
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Take ip off the LRU list. itable.lock must be held.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    itable.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    itable.lrutail = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
+// Put ip at the front of the LRU list, or at the back if
+// it has never been used. itable.lock must be held.
+static void
+lrupush(struct inode *ip)
+{
+  if(ip->inum == 0){
+    ip->lnext = 0;
+    ip->lprev = itable.lrutail;
+    if(itable.lrutail)
+      itable.lrutail->lnext = ip;
+    else
+      itable.lru = ip;
+    itable.lrutail = ip;
+    return;
+  }
+  ip->lprev = 0;
+  ip->lnext = itable.lru;
+  if(itable.lru)
+    itable.lru->lprev = ip;
+  else
+    itable.lrutail = ip;
+  itable.lru = ip;
+}
+
+// Add a page of new, unused entries to the table.
+// Returns 0 if out of memory. itable.lock must be held.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  int i;
+
+  if((ip = kalloc()) == 0)
+    return 0;
+  memset(ip, 0, PGSIZE);
+  for(i = 0; i < PGSIZE / sizeof(struct inode); i++, ip++){
+    initsleeplock(&ip->lock, "inode");
+    lrupush(ip);
+    itable.ninode++;
+  }
+  return 1;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +390,43 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ibucket(dev, inum); ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Recycle the least recently used entry, unless the
+  // table is small or all in use: then grow it.
+  ip = itable.lrutail;
+  if(ip == 0 || (ip->inum != 0 && itable.ninode < NINODE)){
+    if(!igrow() && ip == 0)
+      panic("iget: no inodes");
+  }
+  ip = itable.lrutail;
+  lruremove(ip);
+  if(ip->inum){
+    for(pp = ibucket(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+  }
+  pcacheinval(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->nextblk = 0;
+  ip->next = *ibucket(dev, inum);
+  *ibucket(dev, inum) = ip;
   release(&itable.lock);
 
   return ip;
@@ -357,7 +513,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    lrupush(ip);
   release(&itable.lock);
 }
 
@@ -374,7 +531,55 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after that hang off the double-indirect block
+// ip->addrs[NDIRECT+1], which lists NINDIRECT indirect blocks.
+
+// Allocate a block for ip, right after the one it got last
+// if that is free, so that a file written sequentially is
+// laid out contiguously on disk.
+static uint
+ballocip(struct inode *ip)
+{
+  uint addr;
+
+  addr = balloc(ip->dev, ip->nextblk);
+  if(addr)
+    ip->nextblk = addr + 1;
+  return addr;
+}
+
+// Return entry bn of the indirect block at *ap, allocating
+// the indirect block (recorded in *ap) and the entry as
+// necessary. bp is the block holding *ap, to be logged when
+// the indirect block is allocated, or 0 if *ap is in the inode.
+// returns 0 if out of disk space.
+static uint
+bmapind(struct inode *ip, struct buf *bp, uint *ap, uint bn)
+{
+  uint addr, *a;
+  struct buf *ibp;
+
+  if((addr = *ap) == 0){
+    addr = ballocip(ip);
+    if(addr == 0)
+      return 0;
+    *ap = addr;
+    if(bp)
+      log_write(bp);
+  }
+  ibp = bread(ip->dev, addr);
+  a = (uint*)ibp->data;
+  if((addr = a[bn]) == 0){
+    addr = ballocip(ip);
+    if(addr){
+      a[bn] = addr;
+      log_write(ibp);
+    }
+  }
+  brelse(ibp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -387,7 +592,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = ballocip(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,23 +601,22 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+  if(bn < NINDIRECT)
+    return bmapind(ip, 0, &ip->addrs[NDIRECT], bn);
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, allocating if necessary,
+    // then look bn up in the indirect block it points to.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = ballocip(ip);
       if(addr == 0)
         return 0;
-      ip->addrs[NDIRECT] = addr;
+      ip->addrs[NDIRECT+1] = addr;
     }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
+    addr = bmapind(ip, bp, &a[bn / NINDIRECT], bn % NINDIRECT);
     brelse(bp);
     return addr;
   }
@@ -420,6 +624,24 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists.
+static void
+itruncind(struct inode *ip, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -429,6 +651,10 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
+  if(ip->type == T_DIR)
+    dcacheinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -437,15 +663,20 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    itruncind(ip, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        itruncind(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
   ip->size = 0;
@@ -464,6 +695,44 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read ahead after a read of blocks [bn, last] of ip.
+// A read that starts where the previous one ended (or in the
+// block it ended in) is sequential: keep up to ip->rawin blocks
+// beyond it on their way from the disk, doubling the window
+// each time half of it has been used, up to RAMAX.
+// Any other read resets the window.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint end, nblocks, addr;
+
+  if(bn != ip->ranext && bn + 1 != ip->ranext){
+    ip->rawin = 0;
+    ip->ranext = ip->raend = last + 1;
+    return;
+  }
+  ip->ranext = last + 1;
+  if(ip->raend < last + 1)
+    ip->raend = last + 1;
+
+  // wait until half the window has been read.
+  if(ip->rawin && ip->raend - (last + 1) > ip->rawin / 2)
+    return;
+  if(ip->rawin == 0)
+    ip->rawin = RAMIN;
+  else if(ip->rawin < RAMAX)
+    ip->rawin *= 2;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = min(last + 1 + ip->rawin, nblocks);
+  for(; ip->raend < end; ip->raend++){
+    if((addr = bmap(ip, ip->raend)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -478,6 +747,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n == 0)
+    return 0;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -492,6 +763,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  if(tot == n && ip->type == T_FILE)
+    readahead(ip, (off - n) / BSIZE, (off - 1) / BSIZE);
   return tot;
 }
 
@@ -513,6 +786,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  pcacheinval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -546,6 +821,268 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash a name for a hashed directory (FNV-1a).
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// The bucket for hash h in a hashed directory of n buckets.
+static uint
+dirhome(uint h, uint n)
+{
+  uint m, b;
+
+  for(m = 1; m * 2 <= n; m *= 2)
+    ;
+  b = h % (2 * m);
+  if(b >= n)
+    b = h % m;
+  return b;
+}
+
+// Is dp a hashed directory? See fs.h.
+static int
+dirhashed(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirhdr *hdr;
+  int r;
+
+  if(dp->size < BSIZE || dp->size % BSIZE != 0)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  hdr = (struct dirhdr*)bp->data;
+  r = hdr->inum == 0 && hdr->magic == DIRMAGIC;
+  brelse(bp);
+  return r;
+}
+
+// Add delta to the entry count of hashed directory dp,
+// and return the new count.
+static uint
+dirnent(struct inode *dp, int delta)
+{
+  struct buf *bp;
+  struct dirhdr *hdr;
+  uint n;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  hdr = (struct dirhdr*)bp->data;
+  hdr->nent += delta;
+  n = hdr->nent;
+  log_write(bp);
+  brelse(bp);
+  return n;
+}
+
+// Look for name in hashed directory dp, in the overflow run
+// from bucket b. Returns its inum and sets *poff, or returns 0.
+static uint
+dirprobe(struct inode *dp, char *name, uint b, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint n, i, j, inum, flags;
+
+  n = dp->size / BSIZE;
+  for(i = 0; i < n; i++, b = (b + 1) % n){
+    bp = bread(dp->dev, bmap(dp, b));
+    de = (struct dirent*)bp->data;
+    for(j = 1; j < DPB; j++){
+      if(de[j].inum != 0 && namecmp(name, de[j].name) == 0){
+        inum = de[j].inum;
+        brelse(bp);
+        if(poff)
+          *poff = b * BSIZE + j * sizeof(struct dirent);
+        return inum;
+      }
+    }
+    flags = ((struct dirhdr*)bp->data)->flags;
+    brelse(bp);
+    if((flags & DIRH_OVERFLOW) == 0)
+      break;
+  }
+  return 0;
+}
+
+// The split field of hashed directory dp (see dirsplit()).
+static uint
+dirsplitting(struct inode *dp)
+{
+  struct buf *bp;
+  uint c;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  c = ((struct dirhdr*)bp->data)->split;
+  brelse(bp);
+  return c;
+}
+
+// Look for name in hashed directory dp.
+// Returns its inum and sets *poff, or returns 0.
+static uint
+dirhlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint n, b, c, inum;
+
+  n = dp->size / BSIZE;
+  b = dirhome(dirhash(name), n);
+  if((inum = dirprobe(dp, name, b, poff)) != 0)
+    return inum;
+  // a name that belongs in the newest bucket may not have
+  // been moved there yet by a split.
+  if(b == n - 1 && (c = dirsplitting(dp)) != 0)
+    return dirprobe(dp, name, c - 1, poff);
+  return 0;
+}
+
+// Put e in the first free slot of hashed directory dp,
+// starting at bucket b, and marking full buckets on the way.
+// Returns its byte offset, or -1 if every bucket is full.
+static int
+dirplace(struct inode *dp, struct dirent *e, uint b)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dirhdr *hdr;
+  uint n, i, j;
+
+  n = dp->size / BSIZE;
+  for(i = 0; i < n; i++, b = (b + 1) % n){
+    bp = bread(dp->dev, bmap(dp, b));
+    de = (struct dirent*)bp->data;
+    for(j = 1; j < DPB; j++){
+      if(de[j].inum == 0){
+        de[j] = *e;
+        log_write(bp);
+        brelse(bp);
+        return b * BSIZE + j * sizeof(struct dirent);
+      }
+    }
+    hdr = (struct dirhdr*)bp->data;
+    if((hdr->flags & DIRH_OVERFLOW) == 0){
+      hdr->flags |= DIRH_OVERFLOW;
+      log_write(bp);
+    }
+    brelse(bp);
+  }
+  return -1;
+}
+
+// Called after each new entry in hashed directory dp, which
+// now has nent entries. Once there are more than DIRLOAD per
+// bucket, add a bucket; then, on this and later calls, move
+// the entries that now belong in it out of the bucket it
+// splits and the buckets that one overflowed into, at most
+// DIRSPLITRUN blocks per call, so that the blocks a call
+// writes fit in the caller's transaction. The first block's
+// split field is one more than the next bucket to look at,
+// or 0 if no split is under way.
+static void
+dirsplit(struct inode *dp, uint nent)
+{
+  struct buf *bp;
+  struct dirent *de, e;
+  struct dirhdr *hdr;
+  uint n, m, s, b, c, i, j, addr, flags;
+
+  n = dp->size / BSIZE;
+  if((c = dirsplitting(dp)) == 0){
+    if(nent <= n * DIRLOAD || n >= MAXFILE)
+      return;
+    for(m = 1; m * 2 <= n; m *= 2)
+      ;
+    s = n - m;
+
+    // The new bucket continues any overflow run through n-1.
+    bp = bread(dp->dev, bmap(dp, n - 1));
+    flags = ((struct dirhdr*)bp->data)->flags;
+    brelse(bp);
+    if((addr = bmap(dp, n)) == 0)
+      return;
+    bp = bread(dp->dev, addr);
+    memset(bp->data, 0, BSIZE);
+    hdr = (struct dirhdr*)bp->data;
+    hdr->magic = DIRMAGIC;
+    hdr->flags = flags & DIRH_OVERFLOW;
+    log_write(bp);
+    brelse(bp);
+    dp->size += BSIZE;
+    iupdate(dp);
+    c = s + 1;
+  } else {
+    // Names that hashed to s may be anywhere in its overflow
+    // run; n is now the new bucket.
+    n--;
+    for(m = 1; m * 2 <= n; m *= 2)
+      ;
+    s = n - m;
+    for(b = c - 1, i = 0; i < DIRSPLITRUN; i++){
+      bp = bread(dp->dev, bmap(dp, b));
+      de = (struct dirent*)bp->data;
+      for(j = 1; j < DPB; j++){
+        if(de[j].inum == 0 || dirhome(dirhash(de[j].name), n + 1) != n)
+          continue;
+        e = de[j];
+        memset(&de[j], 0, sizeof(de[j]));
+        log_write(bp);
+        brelse(bp);
+        if(dirplace(dp, &e, n) < 0)
+          panic("dirsplit");
+        bp = bread(dp->dev, bmap(dp, b));
+        de = (struct dirent*)bp->data;
+      }
+      flags = ((struct dirhdr*)bp->data)->flags;
+      brelse(bp);
+      c = 0;
+      if((flags & DIRH_OVERFLOW) == 0)
+        break;
+      // skip the new bucket, which has nothing to move.
+      if((b = (b + 1) % (n + 1)) == n)
+        b = 0;
+      if(b == s)
+        break;
+      c = b + 1;
+    }
+    dcacheinval(dp);
+  }
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  ((struct dirhdr*)bp->data)->split = c;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Make the new, empty directory dp a hashed directory
+// with one bucket. Returns 0 on success, -1 on failure.
+int
+dirinit(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirhdr *hdr;
+  uint addr;
+
+  if(dp->size != 0)
+    panic("dirinit");
+  if((addr = bmap(dp, 0)) == 0)
+    return -1;
+  bp = bread(dp->dev, addr);
+  hdr = (struct dirhdr*)bp->data;
+  hdr->magic = DIRMAGIC;
+  log_write(bp);
+  brelse(bp);
+  dp->size = BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -557,6 +1094,25 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcacheget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dirhashed(dp)){
+    if((inum = dirhlookup(dp, name, &off)) == 0){
+      dcacheput(dp, name, 0, 0);
+      return 0;
+    }
+    dcacheput(dp, name, inum, off);
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1123,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheput(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheput(dp, name, 0, 0);
   return 0;
 }
 
@@ -589,6 +1147,17 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dirhashed(dp)){
+    memset(&de, 0, sizeof(de));
+    strncpy(de.name, name, DIRSIZ);
+    de.inum = inum;
+    if((off = dirplace(dp, &de, dirhome(dirhash(name), dp->size / BSIZE))) < 0)
+      return -1;
+    dcacheput(dp, name, inum, off);
+    dirsplit(dp, dirnent(dp, 1));
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -601,10 +1170,28 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheput(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the directory entry at byte offset off of dp,
+// as found by dirlookup().
+void
+dirunlink(struct inode *dp, uint off)
+{
+  struct dirent de;
+
+  if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: readi");
+  dcacheput(dp, de.name, 0, 0);
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: writei");
+  if(dirhashed(dp))
+    dirnent(dp, -1);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -24,9 +24,10 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +36,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +59,36 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A hashed directory is an array of buckets, one block each,
+// addressed by linear hashing: with n buckets, a name whose
+// hash (32-bit FNV-1a of its first DIRSIZ bytes) is h lives in
+// bucket h % 2m, or h % m if that is n or more, where m is
+// the largest power of two not above n. Each bucket grows the
+// directory by one block and splits bucket n - m once there are
+// DIRLOAD entries per bucket.
+//
+// The first slot of every block holds a dirhdr, whose inum is 0
+// so that programs reading dirents skip it. If a bucket fills
+// up, names go in the next bucket with room, and the full one
+// is marked DIRH_OVERFLOW so lookups go on to the next bucket.
+// A split moves names out of such a run DIRSPLITRUN blocks per
+// new entry; split in the first block records how far it got.
+//
+// Directories whose first slot is not a dirhdr (made by an old
+// mkfs) are searched linearly.
+struct dirhdr {
+  ushort inum;          // always 0
+  ushort flags;         // DIRH_OVERFLOW
+  uint magic;           // must be DIRMAGIC
+  uint nent;            // first block only: number of entries
+  uint split;           // first block only: next run bucket + 1, or 0
+};
+
+#define DIRMAGIC      0x44495248
+#define DIRH_OVERFLOW 0x1
+#define DIRLOAD       48
+#define DIRSPLITRUN   2
+
@@ -1,6 +1,17 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own cache of free pages so that the
+// common kalloc()/kfree() path touches only that CPU's list.
+// Pages move between a CPU cache and the global pool in
+// batches of KMEM_BATCH; a CPU whose cache and the global
+// pool are both empty steals from the other CPUs.
+//
+// Every allocated page also carries a reference count, so
+// that copy-on-write fork can map one page into several page
+// tables. kfree() drops a reference and only returns the page
+// to the free lists when the last one is gone.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +20,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KMEM_BATCH  32               // pages per refill/spill
+#define KMEM_HIGH   (4*KMEM_BATCH)   // spill when a CPU caches more
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +32,25 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+};
+
+struct kmem kmem;           // global pool
+struct kmem cpukmem[NCPU];  // per-CPU caches, indexed by cpuid()
+
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+int pgref[PA2REF(PHYSTOP)]; // references to each physical page
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpukmem[i].lock, "kmem_cpu");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +59,141 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pgref[PA2REF(p)] = 1;
     kfree(p);
+  }
+}
+
+// Add a reference to an allocated page, e.g. when
+// a copy-on-write fork maps it into the child.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&pgref[PA2REF(pa)], 1);
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return pgref[PA2REF(pa)];
+}
+
+// Detach up to n pages from the front of km's free list.
+// km->lock must be held. Returns the chain and
+// its length in *got.
+static struct run*
+takepages(struct kmem *km, int n, int *got)
+{
+  struct run *head, *r;
+  int i;
+
+  head = r = km->freelist;
+  if(r == 0){
+    *got = 0;
+    return 0;
+  }
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  r->next = 0;
+  km->nfree -= i;
+  *got = i;
+  return head;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Prepend a chain of n pages ending at tail to km's free list.
+// km->lock must be held.
+static void
+putpages(struct kmem *km, struct run *head, struct run *tail, int n)
+{
+  tail->next = km->freelist;
+  km->freelist = head;
+  km->nfree += n;
+}
+
+// Drop a reference to the page of physical memory pointed at
+// by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *spill, *tail;
+  struct kmem *km;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pgref[PA2REF(pa)], 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
+  push_off();
+  km = &cpukmem[cpuid()];
+  acquire(&km->lock);
+  putpages(km, r, r, 1);
+  spill = 0;
+  if(km->nfree > KMEM_HIGH)
+    spill = takepages(km, KMEM_BATCH, &n);
+  release(&km->lock);
+  pop_off();
+
+  if(spill){
+    for(tail = spill; tail->next; tail = tail->next)
+      ;
+    acquire(&kmem.lock);
+    putpages(&kmem, spill, tail, n);
+    release(&kmem.lock);
+  }
+}
+
+// Refill the current CPU's cache, first from the global
+// pool and then by stealing half of another CPU's cache.
+// Returns one page for the caller, or 0 if memory is exhausted.
+// Must be called with interrupts disabled.
+static struct run*
+krefill(int id)
+{
+  struct run *r, *tail;
+  struct kmem *km;
+  int n, i;
+
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r = takepages(&kmem, KMEM_BATCH, &n);
   release(&kmem.lock);
+
+  for(i = 1; r == 0 && i < NCPU; i++){
+    km = &cpukmem[(id + i) % NCPU];
+    acquire(&km->lock);
+    r = takepages(km, (km->nfree + 1) / 2, &n);
+    release(&km->lock);
+  }
+
+  if(r == 0)
+    return 0;
+
+  if(r->next){
+    for(tail = r->next; tail->next; tail = tail->next)
+      ;
+    km = &cpukmem[id];
+    acquire(&km->lock);
+    putpages(km, r->next, tail, n - 1);
+    release(&km->lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +203,27 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  km = &cpukmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+
+  if(r == 0)
+    r = krefill(id);
+  pop_off();
 
-  if(r)
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    pgref[PA2REF(r)] = 1;
+  }
   return (void*)r;
 }
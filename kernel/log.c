@@ -6,12 +6,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "timer.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only closed when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,7 +20,21 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log flusher has closed the transaction.
+//
+// The log is double-buffered: the log flusher kernel thread
+// commits a closed transaction while the next one fills.
+// It closes the open transaction once it is idle and either
+// begin_op() needs space or the transaction has been open for
+// LOGWINDOW ticks, so that small updates from many system
+// calls share one commit.
+//
+// end_op() does not wait for the commit, so a system call's
+// updates may reach the disk a little after it returns; they
+// are still atomic, and reach the disk in order. A process
+// that needs them on disk calls fsync(), which closes the
+// open transaction at once and waits for log_sync() to see
+// it committed.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +43,6 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +56,25 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // flusher is closing the transaction, please wait.
+  int full;        // begin_op() is waiting for log space.
+  uint opened;     // ticks when the open transaction logged its first block.
+  int syncing;     // log_sync() is waiting for the open transaction.
+  struct timer nap; // the flusher's wait for more system calls to join.
+  uint nclosed;    // transactions closed so far.
+  uint ncommitted; // transactions committed so far.
   int dev;
-  struct logheader lh;
+  struct logheader lh;      // the open transaction
+  struct buf *buf[LOGSIZE]; // pinned cache buffers of lh.block[]
+
+  // the closed transaction, private to the flusher.
+  struct logheader clh;
+  struct buf *cbuf[LOGSIZE];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -62,11 +87,13 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  kthread(flusher, "logflush");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// during recovery.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
   int tail;
 
@@ -75,8 +102,6 @@ install_trans(int recovering)
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -96,18 +121,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write an in-memory log header to disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,9 +142,9 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -128,10 +153,14 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+      // this op might exhaust log space; wait for the
+      // flusher to close the transaction.
+      log.full = 1;
+      wakeup(&log.outstanding);
+      timercancel(&log.nap);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -142,19 +171,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// lets the flusher close the transaction if this was the
+// last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
+  if(log.closing)
+    panic("log.closing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    wakeup(&log.outstanding);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,44 +189,138 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Copy the closed transaction's blocks from the cache to the
+// log blocks lbuf[], locking them. Runs before any later FS
+// system call can change the cached blocks.
+static void
+snapshot(struct buf **lbuf)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    lbuf[tail] = bread(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(lbuf[tail]->data, from->data, BSIZE);
+    brelse(from);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the log blocks lbuf[] to disk as one group.
 static void
-write_log(void)
+write_log(struct buf **lbuf)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  bstartv(lbuf, 0, log.clh.n, 1);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++)
+    bwait(lbuf[tail]);
+}
+
+// Write the committed log blocks lbuf[] to their home
+// locations, all at once, then release them and unpin
+// the cache copies.
+static void
+install_log(struct buf **lbuf)
+{
+  int tail;
+  uint home[LOGSIZE];
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    home[tail] = log.clh.block[tail];
+  bstartv(lbuf, home, log.clh.n, 1);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(lbuf[tail]);
+    brelse(lbuf[tail]);
+    bunpin(log.cbuf[tail]);
+  }
+}
+
+// Commit the closed transaction, whose blocks snapshot() has
+// copied to lbuf[]. Three ordered phases, each a group of
+// concurrent disk writes: the log blocks, the header, then
+// the home locations.
+static void
+commit(struct buf **lbuf)
+{
+  if (log.clh.n > 0) {
+    write_log(lbuf);        // Write modified blocks to log
+    write_head(&log.clh);   // Write header to disk -- the real commit
+    install_log(lbuf);      // Now install writes to home locations
+    log.clh.n = 0;
+    write_head(&log.clh);   // Erase the transaction from the log
   }
 }
 
+// The log flusher kernel thread.
 static void
-commit()
+flusher(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  struct buf *lbuf[LOGSIZE];
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding > 0 || log.lh.n == 0){
+      sleep(&log.outstanding, &log.lock);
+      continue;
+    }
+    if(!log.full && !log.syncing && ticks - log.opened < LOGWINDOW){
+      // let more system calls join this transaction. the
+      // nap is armed under log.lock, so begin_op() and
+      // log_sync() can always cut it short.
+      timerarm(&log.nap, 1);
+      release(&log.lock);
+      timersleep(&log.nap);
+      acquire(&log.lock);
+      continue;
+    }
+
+    // close the open transaction. new system calls wait
+    // until its blocks have been copied to the log buffers.
+    log.closing = 1;
+    log.full = 0;
+    log.syncing = 0;
+    log.nclosed++;
+    log.clh = log.lh;
+    memmove(log.cbuf, log.buf, sizeof(log.buf));
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    release(&log.lock);
+
+    snapshot(lbuf);
+
+    acquire(&log.lock);
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit(lbuf);
+
+    acquire(&log.lock);
+    log.ncommitted++;
+    wakeup(&log.ncommitted);
+  }
+}
+
+// Wait until every FS system call that has finished so far
+// is committed to disk.
+void
+log_sync(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  target = log.nclosed;
+  if(log.lh.n > 0){
+    // the open transaction, once it closes.
+    target++;
+    log.syncing = 1;
+    wakeup(&log.outstanding);
+    timercancel(&log.nap);
   }
+  while((int)(target - log.ncommitted) > 0)
+    sleep(&log.ncommitted, &log.lock);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -229,6 +350,9 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    log.buf[i] = b;
+    if(log.lh.n == 0)
+      log.opened = ticks;
     log.lh.n++;
   }
   release(&log.lock);
@@ -25,6 +25,8 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // program text page cache
+    dcacheinit();    // directory entry cache
     iinit();         // inode table
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
@@ -0,0 +1,337 @@
+// Memory-mapped files and anonymous memory.
+//
+// mmap() records a region of the address space in a free
+// entry of p->vma[], and maps no pages: uvmfault() calls
+// vmafault() to fill each page on first touch, from the file
+// through the buffer cache, or with zeros.
+//
+// A private page is the process's own copy of the file; fork()
+// shares it copy-on-write. A shared page is mapped read-only
+// until the first store, so that a writable PTE marks a page
+// that must be written back to the file when it is unmapped,
+// by munmap(), exec() or exit(). fork() maps the child to the
+// same shared pages, so parent and child see each other's
+// stores; other processes see them once they are written back.
+//
+// Mappings live between the heap and the trapframe, placed
+// downwards from TRAPFRAME; sbrk() may not grow past the
+// lowest of them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// The mapping of p that contains va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address mapped by mmap(), which
+// bounds the heap; TRAPFRAME if there is none.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base;
+
+  base = TRAPFRAME;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Is [a, a+len) clear of the heap and all mappings?
+static int
+vmafree(struct proc *p, uint64 a, uint64 len)
+{
+  struct vma *v;
+
+  if(a < PGROUNDUP(p->sz) || a + len < a || a + len > TRAPFRAME)
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && a < v->addr + v->len && v->addr < a + len)
+      return 0;
+  return 1;
+}
+
+// Find room for len bytes, as high as possible.
+// Returns 0 if there is none.
+static uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 a;
+
+  a = TRAPFRAME - len;
+ again:
+  if(a > TRAPFRAME || a < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len && a < v->addr + v->len && v->addr < a + len){
+      a = v->addr - len;
+      goto again;
+    }
+  }
+  return a;
+}
+
+// Map len bytes of file f from offset off, or anonymous memory
+// if f is 0, with protection prot (PROT_*) and flags (MAP_*).
+// addr is a hint, used if it is free. Returns the address of
+// the mapping, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+
+  if(len == 0 || ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable || off % PGSIZE != 0)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+  if(len == 0)
+    return -1;
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0){
+      nv = v;
+      break;
+    }
+  }
+  if(nv == 0)
+    return -1;
+  if(addr % PGSIZE != 0 || !vmafree(p, addr, len))
+    if((addr = vmaplace(p, len)) == 0)
+      return -1;
+
+  nv->addr = addr;
+  nv->len = len;
+  nv->prot = (prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) << 1;  // PTE_R, PTE_W, PTE_X
+  nv->flags = flags;
+  nv->f = f ? filedup(f) : 0;
+  nv->off = off;
+  return addr;
+}
+
+// Fill in the page of mapping v that contains va, or make it
+// writable, for a fault by the current process.
+// Returns 0 if the access can now be retried, -1 if it is
+// illegal or memory is exhausted.
+int
+vmafault(pagetable_t pagetable, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint64 a;
+  int perm;
+
+  if(write && (v->prot & PTE_W) == 0)
+    return -1;
+  a = PGROUNDDOWN(va);
+  pte = walk(pagetable, a, 0);
+  if(pte && (*pte & PTE_V)){
+    if(!write)
+      return -1;
+    if(*pte & PTE_COW)
+      return uvmcow(pagetable, a);
+    if(v->flags & MAP_SHARED){
+      *pte |= PTE_W;   // now dirty
+      return 0;
+    }
+    return -1;
+  }
+  if(v->prot == 0)
+    return -1;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    // callers that copy to or from user memory with an inode
+    // locked fault the pages in first (see uvmprefault()).
+    ip = v->f->ip;
+    ilock(ip);
+    if(readi(ip, 0, (uint64)mem, v->off + (a - v->addr), PGSIZE) < 0){
+      iunlock(ip);
+      goto bad;
+    }
+    iunlock(ip);
+  }
+
+  perm = v->prot | PTE_U;
+  if(v->f && (v->flags & MAP_SHARED) && !write)
+    perm &= ~PTE_W;
+  if(mappages(pagetable, a, PGSIZE, (uint64)mem, perm) != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
+
+// Write the dirty pages of v in [a, e) back to its file,
+// as far as the file extends.
+static void
+vmasync(struct proc *p, struct vma *v, uint64 a, uint64 e)
+{
+  struct inode *ip = v->f->ip;
+  pte_t *pte;
+  uint off, n;
+
+  for(; a < e; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_W)) != (PTE_V|PTE_W))
+      continue;
+    off = v->off + (a - v->addr);
+    begin_op();
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap [a, e) of v, writing back dirty shared pages,
+// and shrink or drop v to what is left of it. [a, e) must
+// not be in the middle of v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 a, uint64 e)
+{
+  if(v->f && (v->flags & MAP_SHARED))
+    vmasync(p, v, a, e);
+  uvmunmap(p->pagetable, a, (e - a) / PGSIZE, 1);
+  if(a == v->addr && e == v->addr + v->len){
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+    v->len = 0;
+  } else if(a == v->addr){
+    v->off += e - a;
+    v->addr = e;
+    v->len -= e - a;
+  } else {
+    v->len = a - v->addr;
+  }
+}
+
+// Unmap the pages in [addr, addr+len) from whatever mappings
+// they are in. Returns 0, or -1 if the range is bad or would
+// split a mapping and there is no free entry for its tail.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 a, e;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  e = addr + PGROUNDUP(len);
+  if(e <= addr || e > TRAPFRAME)
+    return -1;
+
+  // a hole in the middle of a mapping splits it in two.
+  if((v = vmalookup(p, addr)) != 0 && addr > v->addr && e < v->addr + v->len){
+    for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+      if(nv->len == 0)
+        break;
+    if(nv == &p->vma[NVMA])
+      return -1;
+    *nv = *v;
+    nv->f = v->f ? filedup(v->f) : 0;
+    nv->off += e - v->addr;
+    nv->addr = e;
+    nv->len = v->addr + v->len - e;
+    v->len = e - v->addr;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || e <= v->addr || v->addr + v->len <= addr)
+      continue;
+    a = addr > v->addr ? addr : v->addr;
+    vmaunmap(p, v, a, e < v->addr + v->len ? e : v->addr + v->len);
+  }
+  return 0;
+}
+
+// Unmap all of the current process's mappings,
+// for exec() and exit().
+void
+munmapall(void)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v, v->addr, v->addr + v->len);
+}
+
+// Give np the mappings of p, sharing their pages: shared ones
+// as they are, private ones copy-on-write (see uvmcopy()).
+// Returns 0 on success, -1 on failure, with np's mappings
+// dropped again.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint64 a, pa;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    nv->f = v->f ? filedup(v->f) : 0;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        goto bad;
+      kdup((void*)pa);
+    }
+  }
+  return 0;
+
+ bad:
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->len == 0)
+      continue;
+    uvmunmap(np->pagetable, nv->addr, nv->len / PGSIZE, 1);
+    if(nv->f)
+      fileclose(nv->f);
+    nv->f = 0;
+    nv->len = 0;
+  }
+  return -1;
+}
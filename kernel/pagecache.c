@@ -0,0 +1,153 @@
+// Program text page cache.
+//
+// Caches the pages of read-only ELF segments, keyed by
+// (dev, inum, file offset), so that every process running
+// the same program maps the same physical pages, and a
+// repeated exec() does not read the text from the file again.
+//
+// The cache holds its own reference (see kdup()) on each
+// page, and hands out another reference to every caller of
+// pcacheget(). Evicting an entry only drops the cache's
+// reference; processes that map the page keep it.
+//
+// Writing or truncating a file, and recycling its in-memory
+// inode, invalidates its cached pages (see pcacheinval()).
+// ip->text records whether there may be any, so that the
+// common writei() does not have to look.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NPCBUCKET 61
+
+struct ppage {
+  uint dev;
+  uint inum;
+  uint off;             // file offset of the page
+  uint n;               // bytes read from the file; the rest is zero
+  char *pa;             // 0 if this entry is free
+  struct ppage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct ppage page[NPCACHE];
+  struct ppage *bucket[NPCBUCKET];
+  int hand;             // next eviction candidate
+} pcache;
+
+static struct ppage**
+pcachebucket(uint dev, uint inum, uint off)
+{
+  return &pcache.bucket[(dev * 31 + inum * 17 + off / PGSIZE) % NPCBUCKET];
+}
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page holding n bytes of ip at off, with a
+// reference for the caller, or 0 if it is not cached.
+char*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct ppage *pp;
+  char *pa = 0;
+
+  acquire(&pcache.lock);
+  for(pp = *pcachebucket(ip->dev, ip->inum, off); pp; pp = pp->next){
+    if(pp->dev == ip->dev && pp->inum == ip->inum && pp->off == off && pp->n == n){
+      pa = pp->pa;
+      kdup(pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Unlink an entry from its hash chain and drop the
+// cache's reference to its page.
+// pcache.lock must be held.
+static void
+pcachedrop(struct ppage *pp)
+{
+  struct ppage **pq;
+
+  for(pq = pcachebucket(pp->dev, pp->inum, pp->off); *pq != pp; pq = &(*pq)->next)
+    ;
+  *pq = pp->next;
+  kfree(pp->pa);
+  pp->pa = 0;
+}
+
+// Remember pa as the page holding n bytes of ip at off.
+// The cache takes its own reference; the caller keeps its own.
+// Caller must hold ip->lock.
+void
+pcacheput(struct inode *ip, uint off, uint n, char *pa)
+{
+  struct ppage *pp, **b;
+  int i;
+
+  acquire(&pcache.lock);
+  b = pcachebucket(ip->dev, ip->inum, off);
+  for(pp = *b; pp; pp = pp->next){
+    if(pp->dev == ip->dev && pp->inum == ip->inum && pp->off == off){
+      // someone else got here first.
+      release(&pcache.lock);
+      return;
+    }
+  }
+
+  // Use a free entry, or else evict round-robin.
+  pp = 0;
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.page[i].pa == 0){
+      pp = &pcache.page[i];
+      break;
+    }
+  }
+  if(pp == 0){
+    pp = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    pcachedrop(pp);
+  }
+
+  pp->dev = ip->dev;
+  pp->inum = ip->inum;
+  pp->off = off;
+  pp->n = n;
+  pp->pa = pa;
+  kdup(pa);
+  pp->next = *b;
+  *b = pp;
+  ip->text = 1;
+  release(&pcache.lock);
+}
+
+// Forget all cached pages of ip, because its contents
+// changed or its table entry is being recycled.
+// Caller must hold ip->lock, or own the only reference.
+void
+pcacheinval(struct inode *ip)
+{
+  struct ppage *pp;
+
+  if(ip->text == 0)
+    return;
+  acquire(&pcache.lock);
+  for(pp = pcache.page; pp < &pcache.page[NPCACHE]; pp++)
+    if(pp->pa && pp->dev == ip->dev && pp->inum == ip->inum)
+      pcachedrop(pp);
+  ip->text = 0;
+  release(&pcache.lock);
+}
@@ -2,12 +2,24 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      200  // i-nodes cached before recycling unused ones
 #define NDEV         10  // maximum major device number
+#define PIPEPAGES     4  // pages of buffer per pipe
+#define NQUEUE        3  // scheduler priority levels
+#define BOOSTTICKS  100  // ticks between priority boosts
+#define MTIMEFREQ   10000000  // CLINT_MTIME counts per second (qemu)
+#define HZ          10    // clock ticks per second
+#define TICKCYCLES  (MTIMEFREQ/HZ)  // CLINT_MTIME counts per clock tick
+#define IDLETICKS   100   // most ticks an idle CPU goes without a clock interrupt
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define NSEG          4  // max demand-paged ELF segments per program
+#define NVMA         16  // max mmap() regions per process
+#define NPCACHE     256  // size of program text page cache
+#define NDCACHE     128  // size of directory entry cache
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*30) // size of disk block cache
+#define LOGWINDOW     1  // ticks a log transaction stays open for group commit
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
@@ -8,21 +8,60 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
+// A pipe buffers up to PIPESIZE bytes in a ring of PIPEPAGES
+// separately allocated pages, and copies data in and out a
+// contiguous run at a time. A reader that finds the pipe
+// empty posts where it wants the data, and the next writer
+// copies straight from its own memory to the reader's.
+//
+// splice() instead fills or drains the buffer in place, with
+// pi->lock released; meanwhile it keeps other writers (or
+// readers) out with wbusy (or rbusy).
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers sleeping for data
+  int nwsleep;    // writers sleeping for space
+  int wbusy;      // a splice is filling the buffer
+  int rbusy;      // a splice is draining the buffer
+  struct proc *hreader; // reader waiting for a direct handoff
+  uint64 haddr;   // its destination
+  int hn;         // room left there; 0 once a writer is done with it
+  int hdone;      // bytes a writer copied there
 };
 
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  kfree((char*)pi);
+}
+
+// The run of buffer starting at byte off of the stream,
+// and its length up to the end of its page.
+static char*
+piperun(struct pipe *pi, uint off, int *n)
+{
+  off %= PIPESIZE;
+  *n = PGSIZE - off % PGSIZE;
+  return pi->page[off / PGSIZE] + off % PGSIZE;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
@@ -30,10 +69,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +88,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,63 +109,218 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user virtual address if user
+// is set and a kernel address otherwise.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
+  char *run;
   struct proc *pr = myproc();
 
+  // copyin() below must not sleep to page in program text.
+  if(user)
+    uvmprefault(pr->pagetable, addr, n);
+
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(user && pi->hreader && pi->hn > 0 && !pi->wbusy && pi->nread == pi->nwrite){
+      // a reader waits on the empty pipe: hand it the data
+      // directly. copyuser() stops short rather than fault
+      // in the reader's pages; the rest goes in the buffer.
+      m = n - i < pi->hn ? n - i : pi->hn;
+      if((m = copyuser(pi->hreader->pagetable, pi->haddr, pr->pagetable, addr + i, m)) < 0)
+        break;
+      pi->hn = 0;
+      pi->hdone = m;
+      i += m;
+    } else if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      if(pi->nrsleep)
+        wakeup(&pi->nread);
+      pi->nwsleep++;
       sleep(&pi->nwrite, &pi->lock);
+      pi->nwsleep--;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      run = piperun(pi, pi->nwrite, &m);
+      if(m > PIPESIZE - (pi->nwrite - pi->nread))
+        m = PIPESIZE - (pi->nwrite - pi->nread);
+      if(m > n - i)
+        m = n - i;
+      if(either_copyin(run, user, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  if(pi->nrsleep)
+    wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes to addr, a user virtual address if
+// user is set and a kernel address otherwise.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  char *run;
   struct proc *pr = myproc();
-  char ch;
+
+  // copyout() below must not sleep to page in program data,
+  // and a writer can hand off only to pages already mapped
+  // writable.
+  if(user)
+    uvmprefault(pr->pagetable, addr, n);
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
+    if(pi->hreader == pr && pi->hdone > 0)
+      break;
     if(killed(pr)){
+      if(pi->hreader == pr)
+        pi->hreader = 0;
       release(&pi->lock);
       return -1;
     }
+    if(user && !pi->rbusy && pi->hreader == 0 && n > 0){
+      pi->hreader = pr;
+      pi->haddr = addr;
+      pi->hn = n;
+      pi->hdone = 0;
+    }
+    pi->nrsleep++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->nrsleep--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  i = 0;
+  if(pi->hreader == pr){
+    i = pi->hdone;
+    pi->hreader = 0;
+  }
+  while(i < n && !pi->rbusy && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    run = piperun(pi, pi->nread, &m);
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(either_copyout(user, addr + i, run, m) == -1)
       break;
+    pi->nread += m;
+    i += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->nwsleep)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Wait for room in the buffer, and return in *run the next
+// free run of it, which the caller may fill with up to the
+// returned number of bytes (at most n) and then must pass
+// to pipecommit(). Returns -1 if the read side is closed or
+// the caller is killed.
+int
+pipereserve(struct pipe *pi, char **run, int n)
+{
+  int m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    if(pi->nrsleep)
+      wakeup(&pi->nread);
+    pi->nwsleep++;
+    sleep(&pi->nwrite, &pi->lock);
+    pi->nwsleep--;
+  }
+  if(pi->readopen == 0 || killed(pr)){
+    release(&pi->lock);
+    return -1;
+  }
+  *run = piperun(pi, pi->nwrite, &m);
+  if(m > PIPESIZE - (pi->nwrite - pi->nread))
+    m = PIPESIZE - (pi->nwrite - pi->nread);
+  if(m > n)
+    m = n;
+  pi->wbusy = 1;
+  release(&pi->lock);
+  return m;
+}
+
+// Append the first m bytes of the run from pipereserve().
+void
+pipecommit(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nwrite += m;
+  pi->wbusy = 0;
+  if(pi->nrsleep)
+    wakeup(&pi->nread);
+  if(pi->nwsleep)
+    wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// Wait for data, and return in *run the next run of it,
+// from which the caller may take up to the returned number
+// of bytes (at most n) and then must pass the number taken
+// to pipeconsume(). Returns 0 at end of file, and -1 if
+// the caller is killed.
+int
+pipepeek(struct pipe *pi, char **run, int n)
+{
+  int m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){
+    if(killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    pi->nrsleep++;
+    sleep(&pi->nread, &pi->lock);
+    pi->nrsleep--;
+  }
+  if(pi->nread == pi->nwrite){
+    release(&pi->lock);
+    return 0;
+  }
+  *run = piperun(pi, pi->nread, &m);
+  if(m > pi->nwrite - pi->nread)
+    m = pi->nwrite - pi->nread;
+  if(m > n)
+    m = n;
+  pi->rbusy = 1;
+  release(&pi->lock);
+  return m;
+}
+
+// Remove the first m bytes of the run from pipepeek().
+void
+pipeconsume(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->rbusy = 0;
+  if(pi->nwsleep)
+    wakeup(&pi->nwrite);
+  if(pi->nrsleep)
+    wakeup(&pi->nread);
+  release(&pi->lock);
+}
@@ -16,10 +16,62 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void runqput(struct proc *p, int woken);
+static struct proc *runqget(void);
 
 extern char trampoline[]; // trampoline.S
 
+// Each CPU has its own run queues: one FIFO queue per
+// priority, 0 being the highest. A process that uses up its
+// time slice (QUANTUM(priority) ticks) drops a level; one that
+// wakes up from sleep() rises a level, so interactive and
+// I/O-bound processes stay ahead of compute-bound ones. Every
+// BOOSTTICKS ticks all processes go back to priority 0, so that
+// none starves. A CPU's scheduler takes the head of its highest
+// non-empty queue, found from a bitmap, and only when all its
+// queues are empty steals from another CPU.
+//
+// A process that becomes runnable goes back to the CPU it last
+// ran on, for cache locality, unless that CPU is busier than
+// the least busy one it may run on (see p->affinity).
+//
+// A run queue's lock protects its queues and the priority,
+// slice, boost and rqnext of the processes on them; a running
+// process's are used only by itself. A run queue lock may be
+// acquired while holding a p->lock, but not the other way around.
+#define QUANTUM(pri) (1 << (pri))
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NQUEUE];
+  struct proc *tail[NQUEUE];
+  uint nonempty;        // bit i set if queue i is non-empty
+  int nready;           // processes on the queues
+  int online;           // has this CPU started scheduling?
+} runqs[NCPU];
+
+int runqboosts;         // number of boosts so far
+
+// Sleeping processes are kept in wait queues hashed by
+// channel, so that wakeup() looks only at processes that
+// may be sleeping on its channel. A wait queue's lock
+// protects its list and the wqnext of the processes on it,
+// and must be acquired before any p->lock.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitqs[NWAITQ];
+
+static struct waitq*
+waitq(void *chan)
+{
+  return &waitqs[((uint64)chan / 8) % NWAITQ];
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -50,7 +102,11 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +180,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->priority = 0;
+  p->slice = 0;
+  p->affinity = ~0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -168,6 +227,12 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->exe = 0;
+  p->nseg = 0;
+  if(p->ring)
+    kfree((void*)p->ring);
+  p->ring = 0;
+  p->kfunc = 0;
   p->state = UNUSED;
 }
 
@@ -250,8 +315,53 @@ userinit(void)
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
+  runqput(p, 0);
+
+  release(&p->lock);
+}
+
+// Start a kernel thread that runs fn(), which must never
+// return. It has no user memory and never enters user space.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfunc = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  runqput(p, 0);
+  release(&p->lock);
+}
 
+// Restrict the current process to the CPUs in mask, moving
+// it if this CPU is not one of them.
+// Returns -1 if none of them is running.
+int
+setaffinity(uint mask)
+{
+  struct proc *p = myproc();
+  int i, id;
+
+  for(i = 0; i < NCPU; i++)
+    if((mask & (1 << i)) && runqs[i].online)
+      break;
+  if(i == NCPU)
+    return -1;
+
+  acquire(&p->lock);
+  p->affinity = mask;
   release(&p->lock);
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  if((mask & (1 << id)) == 0)
+    yield();
+  return 0;
 }
 
 // Grow or shrink user memory by n bytes.
@@ -264,9 +374,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // just reserve the address space; usertrap() and
+    // copyin()/copyout() fault the pages in on first touch.
+    if(sz + n < sz || sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -295,6 +407,12 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->affinity = p->affinity;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -307,6 +425,10 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -320,6 +442,7 @@ fork(void)
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  runqput(np, 0);
   release(&np->lock);
 
   return pid;
@@ -351,6 +474,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and drop mapped files and memory.
+  munmapall();
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +488,12 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
+  p->nseg = 0;
 
   acquire(&wait_lock);
 
@@ -391,7 +521,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -406,17 +536,17 @@ wait(uint64 addr)
 
         havekids = 1;
         if(pp->state == ZOMBIE){
-          // Found one.
+          // Found one. copyout() may have to read in a page
+          // of a mapped file, which sleeps, so it comes after
+          // the locks are released.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -446,28 +576,44 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
+  runqs[id].online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqget()) == 0){
+      // nothing to run; stop the clock until the next timer
+      // is due and wait for an interrupt. with interrupts off,
+      // a runqput() that misses the recheck below still leaves
+      // its timerkick() pending, which ends the wfi.
+      intr_off();
+      timeridle();
+      c->idle = 1;
+      __sync_synchronize();
+      if(runqs[id].nready == 0)
+        wfi();
+      c->idle = 0;
+      timerbusy();
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
   }
 }
 
@@ -505,6 +651,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  runqput(p, 0);
   sched();
   release(&p->lock);
 }
@@ -530,34 +677,63 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfunc();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitq(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold the wait queue's lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it, and then p->lock),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took us off the wait queue, unless
+  // kill() woke us.
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      break;
+    }
+  }
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -566,17 +742,25 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = waitq(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(pp = &wq->head; (p = *pp) != 0; ){
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
         p->state = RUNNABLE;
+        runqput(p, 1);
+        *pp = p->wqnext;
+        release(&p->lock);
+        continue;
       }
       release(&p->lock);
     }
+    pp = &p->wqnext;
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -594,6 +778,7 @@ kill(int pid)
       if(p->state == SLEEPING){
         // Wake process from sleep().
         p->state = RUNNABLE;
+        runqput(p, 1);
       }
       release(&p->lock);
       return 0;
@@ -681,3 +866,202 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Append p to its priority's queue in rq.
+// rq->lock must be held.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  p->rqnext = 0;
+  if(rq->tail[p->priority])
+    rq->tail[p->priority]->rqnext = p;
+  else
+    rq->head[p->priority] = p;
+  rq->tail[p->priority] = p;
+  rq->nonempty |= 1 << p->priority;
+  rq->nready++;
+}
+
+// Unlink p, which follows prev (0 if p is first), from its
+// queue in rq. rq->lock must be held.
+static void
+dequeue(struct runq *rq, struct proc *p, struct proc *prev)
+{
+  int q = p->priority;
+
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    rq->head[q] = p->rqnext;
+  if(rq->tail[q] == p)
+    rq->tail[q] = prev;
+  if(rq->head[q] == 0)
+    rq->nonempty &= ~(1 << q);
+  p->rqnext = 0;
+  rq->nready--;
+}
+
+// How busy is CPU i? Only a hint: no locks are held.
+static int
+cpuload(int i)
+{
+  return runqs[i].nready + (cpus[i].proc != 0);
+}
+
+// Choose the CPU whose run queue should get p.
+static int
+runqpick(struct proc *p)
+{
+  int i, best;
+
+  best = -1;
+  for(i = 0; i < NCPU; i++){
+    if(!runqs[i].online || (p->affinity & (1 << i)) == 0)
+      continue;
+    if(best < 0 || cpuload(i) < cpuload(best))
+      best = i;
+  }
+  if(best < 0)
+    return cpuid();   // still booting
+  // stay on p's last CPU unless that means waiting behind
+  // more work, or while another CPU sits idle.
+  if((p->affinity & (1 << p->cpu)) && runqs[p->cpu].online &&
+     cpuload(p->cpu) <= cpuload(best) + (cpuload(best) > 0))
+    return p->cpu;
+  return best;
+}
+
+// Put p, which has just become RUNNABLE, at the tail of its
+// priority's queue on some CPU. If it was woken up from
+// sleep(), raise its priority first.
+// Caller must hold p->lock.
+static void
+runqput(struct proc *p, int woken)
+{
+  struct runq *rq;
+
+  if(!holding(&p->lock) || p->state != RUNNABLE)
+    panic("runqput");
+
+  p->cpu = runqpick(p);
+  rq = &runqs[p->cpu];
+  acquire(&rq->lock);
+  if(p->boost != runqboosts){
+    // missed a boost while running or asleep.
+    p->boost = runqboosts;
+    p->priority = 0;
+    p->slice = 0;
+  }
+  if(woken && p->priority > 0){
+    p->priority--;
+    p->slice = 0;
+  }
+  enqueue(rq, p);
+  release(&rq->lock);
+
+  // an idle CPU has stopped its clock; wake it up.
+  if(cpus[p->cpu].idle)
+    timerkick(p->cpu);
+}
+
+// Take the first process of the highest-priority non-empty
+// queue of this CPU, or else steal the highest-priority
+// process that may run here from another CPU.
+// Returns 0 if there is nothing to run.
+// Called only by this CPU's scheduler.
+static struct proc*
+runqget(void)
+{
+  struct runq *rq;
+  struct proc *p, *prev;
+  int id, i, q;
+
+  id = cpuid();
+  rq = &runqs[id];
+  acquire(&rq->lock);
+  if(rq->nonempty){
+    p = rq->head[__builtin_ctz(rq->nonempty)];
+    dequeue(rq, p, 0);
+    release(&rq->lock);
+    return p;
+  }
+  release(&rq->lock);
+
+  for(i = 1; i < NCPU; i++){
+    rq = &runqs[(id + i) % NCPU];
+    if(rq->nready == 0)
+      continue;
+    acquire(&rq->lock);
+    for(q = 0; q < NQUEUE; q++){
+      prev = 0;
+      for(p = rq->head[q]; p; prev = p, p = p->rqnext){
+        if(p->affinity & (1 << id)){
+          dequeue(rq, p, prev);
+          release(&rq->lock);
+          p->cpu = id;
+          return p;
+        }
+      }
+    }
+    release(&rq->lock);
+  }
+  return 0;
+}
+
+// Move every queued process to priority 0, and let the
+// others find out when they are next queued.
+// Called from the timer interrupt every BOOSTTICKS ticks.
+void
+runqboost(void)
+{
+  struct runq *rq;
+  struct proc *p;
+  int q;
+
+  __sync_fetch_and_add(&runqboosts, 1);
+  for(rq = runqs; rq < &runqs[NCPU]; rq++){
+    acquire(&rq->lock);
+    for(q = 1; q < NQUEUE; q++){
+      if(rq->head[q] == 0)
+        continue;
+      for(p = rq->head[q]; p; p = p->rqnext){
+        p->priority = 0;
+        p->slice = 0;
+      }
+      if(rq->tail[0])
+        rq->tail[0]->rqnext = rq->head[q];
+      else
+        rq->head[0] = rq->head[q];
+      rq->tail[0] = rq->tail[q];
+      rq->head[q] = rq->tail[q] = 0;
+    }
+    for(p = rq->head[0]; p; p = p->rqnext)
+      p->boost = runqboosts;
+    rq->nonempty = rq->head[0] ? 1 : 0;
+    release(&rq->lock);
+  }
+}
+
+// Charge the current process for a timer tick, and give up
+// the CPU if its time slice is used up (dropping a priority
+// level) or a higher-priority process is waiting here.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  int preempt;
+
+  if(++p->slice >= QUANTUM(p->priority)){
+    if(p->priority < NQUEUE - 1)
+      p->priority++;
+    p->slice = 0;
+    preempt = 1;
+  } else {
+    push_off();
+    preempt = (runqs[cpuid()].nonempty & ((1 << p->priority) - 1)) != 0;
+    pop_off();
+  }
+
+  if(preempt)
+    yield();
+}
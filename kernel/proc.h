@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // Waiting for an interrupt, clock stopped?
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +80,27 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable ELF segment of the running program. exec() leaves
+// its pages unmapped; uvmfault() pages them in from p->exe.
+struct seg {
+  uint64 vaddr;   // page-aligned start address
+  uint64 memsz;   // bytes in memory; those past filesz are zero
+  uint off;       // file offset of vaddr
+  uint filesz;    // bytes backed by the file
+  int perm;       // PTE_X and/or PTE_W
+};
+
+// A region of memory mapped by mmap(). uvmfault() fills in
+// its pages on first touch (see mmap.c).
+struct vma {
+  uint64 addr;    // page-aligned start address
+  uint64 len;     // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;       // PTE_R, PTE_W and/or PTE_X
+  int flags;      // MAP_SHARED or MAP_PRIVATE
+  struct file *f; // mapped file, or 0 for anonymous memory
+  uint off;       // file offset of addr
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,6 +113,17 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint affinity;               // Bitmask of CPUs the process may run on
+  int cpu;                     // CPU whose run queue it is on, or last ran on
+
+  // runqs[p->cpu].lock must be held when using these:
+  int priority;                // Scheduling queue, 0 is highest
+  int slice;                   // Ticks used of this priority's time slice
+  int boost;                   // runqboosts when priority was last reset
+  struct proc *rqnext;         // Next in run queue
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next sleeping on the same wait queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -101,7 +134,13 @@ struct proc {
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
+  void (*kfunc)(void);         // Body of a kernel thread, or 0
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file, for demand paging
+  struct seg seg[NSEG];        // Program segments not yet paged in
+  int nseg;                    // Number of entries in seg[]
+  struct vma vma[NVMA];        // Memory mapped by mmap()
+  struct ring *ring;           // Kernel's view of the ringsetup() page, or 0
   char name[16];               // Process name (debugging)
 };
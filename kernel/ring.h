@@ -0,0 +1,44 @@
+// Submission and completion rings, shared between a process
+// and the kernel in the page that ringsetup() maps.
+//
+// The process fills in sq[sqtail % RINGSIZE] and advances
+// sqtail; ringenter() performs queued operations in order,
+// advancing sqhead, and posts each result to cq[cqtail %
+// RINGSIZE], advancing cqtail. The process reaps completions
+// from cqhead without entering the kernel.
+
+#define RINGSIZE 64   // entries in each ring
+
+#define RING_NOP    0
+#define RING_READ   1   // read(fd, addr, n)
+#define RING_WRITE  2   // write(fd, addr, n)
+#define RING_PREAD  3   // pread(fd, addr, n, off)
+#define RING_PWRITE 4   // pwrite(fd, addr, n, off)
+#define RING_OPEN   5   // open(addr, n)
+#define RING_CLOSE  6   // close(fd)
+
+// submission queue entry
+struct sqe {
+  int op;         // RING_*
+  int fd;
+  uint64 addr;    // buffer, or path for RING_OPEN
+  int n;          // byte count, or mode for RING_OPEN
+  uint off;       // file offset for RING_PREAD/RING_PWRITE
+  uint64 udata;   // copied to the completion
+};
+
+// completion queue entry
+struct cqe {
+  uint64 udata;   // from the submission
+  int res;        // what the system call would have returned
+  int pad;
+};
+
+struct ring {
+  uint sqhead;    // next submission for the kernel
+  uint sqtail;    // next free submission slot, for the process
+  uint cqhead;    // next completion for the process
+  uint cqtail;    // next free completion slot, for the kernel
+  struct sqe sq[RINGSIZE];
+  struct cqe cq[RINGSIZE];
+};
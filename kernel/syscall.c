@@ -101,6 +101,19 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_getcpu(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +139,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fsync]   sys_fsync,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_splice]  sys_splice,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_getcpu]  sys_getcpu,
 };
 
 void
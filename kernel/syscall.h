@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_setaffinity 23
+#define SYS_nanosleep 24
+#define SYS_splice 25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_pread  30
+#define SYS_pwrite 31
+#define SYS_ringsetup 32
+#define SYS_ringenter 33
+#define SYS_getcpu 34
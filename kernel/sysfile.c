@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +95,120 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Move up to n bytes from fd_in to fd_out within the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
+// Map a file, or anonymous memory if fd is -1.
+uint64
+sys_mmap(void)
+{
+  struct file *f;
+  uint64 addr, len;
+  int prot, flags, fd, off;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(4, &fd);
+  argint(5, &off);
+  f = 0;
+  if(fd != -1 && argfd(4, 0, &f) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+// Wait until the file's updates, and every other finished
+// FS system call's, are on disk.
+uint64
+sys_fsync(void)
+{
+  if(argfd(0, 0, 0) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  int iovcnt;
+  uint64 iov;
+
+  argaddr(1, &iov);
+  argint(2, &iovcnt);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  int iovcnt;
+  uint64 iov;
+
+  argaddr(1, &iov);
+  argint(2, &iovcnt);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
 uint64
 sys_close(void)
 {
@@ -176,10 +291,10 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -189,7 +304,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +333,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -275,7 +387,7 @@ create(char *path, short type, short major, short minor)
 
   if(type == T_DIR){  // Create . and .. entries.
     // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
+    if(dirinit(ip) < 0 || dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       goto fail;
   }
 
@@ -301,18 +413,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for sys_open() and RING_OPEN.
+// Returns a new file descriptor, or -1.
+static int
+open(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -370,6 +478,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return open(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -503,3 +623,98 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Map a submission/completion ring (see ring.h) into the
+// process, and return its address. The kernel keeps its
+// own reference to the page, so ringenter() can use it
+// however the process remaps its memory.
+uint64
+sys_ringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+  uint64 addr;
+
+  if(p->ring)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if((addr = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, 0, 0)) == -1)
+    goto bad;
+  if(mappages(p->pagetable, addr, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    munmap(addr, PGSIZE);
+    goto bad;
+  }
+  kdup(mem);
+  p->ring = (struct ring*)mem;
+  return addr;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
+
+// Perform one queued operation, as its system call would.
+static int
+ringop(struct sqe *e)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  char path[MAXPATH];
+
+  if(e->op == RING_NOP)
+    return 0;
+  if(e->op == RING_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return open(path, e->n);
+  }
+  if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case RING_READ:
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    return filewrite(f, e->addr, e->n);
+  case RING_PREAD:
+    return filepread(f, e->addr, e->n, e->off);
+  case RING_PWRITE:
+    return filepwrite(f, e->addr, e->n, e->off);
+  case RING_CLOSE:
+    p->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// Perform up to n queued operations in order, stopping early
+// if the completion ring fills up, and return how many.
+uint64
+sys_ringenter(void)
+{
+  struct ring *r = myproc()->ring;
+  struct sqe e;
+  int n, i, res;
+
+  argint(0, &n);
+  if(r == 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    __sync_synchronize();
+    if(r->sqhead == r->sqtail || r->cqtail - r->cqhead >= RINGSIZE)
+      break;
+    // the process may change the entry while we work.
+    e = r->sq[r->sqhead % RINGSIZE];
+    r->sqhead++;
+    res = ringop(&e);
+    r->cq[r->cqtail % RINGSIZE].udata = e.udata;
+    r->cq[r->cqtail % RINGSIZE].res = res;
+    __sync_synchronize();
+    r->cqtail++;
+    if(killed(myproc()))
+      break;
+  }
+  return i;
+}
@@ -52,20 +52,18 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return ticksleep(n);
+}
+
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return nanosleep(ns);
 }
 
 uint64
@@ -89,3 +87,25 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+uint64
+sys_setaffinity(void)
+{
+  int mask;
+
+  argint(0, &mask);
+  return setaffinity(mask);
+}
+
+// The CPU the caller is running on, which may have
+// changed by the time it looks, unless it is pinned.
+uint64
+sys_getcpu(void)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  return id;
+}
@@ -0,0 +1,274 @@
+// Timer wheel, for sleeping until a deadline.
+//
+// A process that sleeps for a number of clock ticks hangs a
+// timer on the wheel slot for its deadline (mod NWHEEL). Each
+// clock tick, clockintr() looks only at the timers in the slot
+// for the new time, and wakes the ones that are due, each once.
+// A timer due more than NWHEEL ticks ahead stays in its slot
+// for a few revolutions. A kernel thread may instead arm a
+// timer of its own, which other code can cancel to wake it
+// early.
+//
+// An exact timer, for nanosleep(), also has a CLINT_MTIME
+// deadline, and hangs in the slot of the first tick after it,
+// which wakes it if nothing has sooner. Once the wheel reaches
+// the tick before, exactdue holds the earliest such deadline
+// in that slot, and CPUs take a clock interrupt then too.
+//
+// tickslock protects the wheel and exactdue.
+//
+// Busy CPUs take a clock interrupt every tick. An idle CPU
+// instead sets its CLINT_MTIMECMP to when the next timer is
+// due, and a CPU that gives it work sets it to now.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "timer.h"
+
+#define NWHEEL 64
+
+struct timer *wheel[NWHEEL];
+uint64 exactdue;        // first exact deadline before the next tick, or 0
+
+// Called by clockintr() with tickslock held, after
+// advancing ticks: fire the timers that are due.
+void
+timertick(void)
+{
+  struct timer *t, **tp;
+
+  tp = &wheel[ticks % NWHEEL];
+  while((t = *tp) != 0){
+    if((int)(t->expire - ticks) <= 0){
+      *tp = t->next;
+      t->fired = 1;
+      wakeup(t);
+    } else {
+      tp = &t->next;
+    }
+  }
+}
+
+// Called by clockintr() with tickslock held, after
+// timertick(): fire the exact timers due before the next
+// tick that are already due, and set exactdue for the rest.
+void
+timerexact(void)
+{
+  struct timer *t, **tp;
+  uint64 now;
+
+  now = mtime();
+  exactdue = 0;
+  tp = &wheel[(ticks + 1) % NWHEEL];
+  while((t = *tp) != 0){
+    if(t->when == 0 || t->expire != ticks + 1){
+      tp = &t->next;
+    } else if(t->when <= now){
+      *tp = t->next;
+      t->fired = 1;
+      wakeup(t);
+    } else {
+      if(exactdue == 0 || t->when < exactdue)
+        exactdue = t->when;
+      tp = &t->next;
+    }
+  }
+}
+
+// Is an exact timer due before the next tick?
+// Looks at exactdue without tickslock, so it may be wrong,
+// which costs a clock interrupt or a tick of delay.
+int
+timerdue(void)
+{
+  return exactdue && exactdue <= mtime();
+}
+
+// Hang t on the wheel. Called with tickslock held.
+static void
+timerhang(struct timer *t)
+{
+  t->fired = 0;
+  t->next = wheel[t->expire % NWHEEL];
+  wheel[t->expire % NWHEEL] = t;
+}
+
+// Take t off the wheel, if it is on it.
+// Called with tickslock held.
+static int
+timerunhang(struct timer *t)
+{
+  struct timer **tp;
+
+  for(tp = &wheel[t->expire % NWHEEL]; *tp; tp = &(*tp)->next){
+    if(*tp == t){
+      *tp = t->next;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Hang t on the wheel and sleep until it fires.
+// Called with tickslock held, which is released.
+// Returns -1 if killed first, else 0.
+static int
+timerwait(struct timer *t)
+{
+  timerhang(t);
+  while(!t->fired){
+    if(killed(myproc())){
+      timerunhang(t);
+      release(&tickslock);
+      return -1;
+    }
+    sleep(t, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
+
+// Hang t on the wheel to fire n clock ticks from now, for a
+// kernel thread that will timersleep() on it, and whose wakers
+// can timercancel() it to cut the sleep short.
+void
+timerarm(struct timer *t, uint n)
+{
+  acquire(&tickslock);
+  t->expire = ticks + n;
+  t->when = 0;
+  timerhang(t);
+  release(&tickslock);
+}
+
+// Sleep until t, armed by timerarm(), fires or is cancelled.
+void
+timersleep(struct timer *t)
+{
+  acquire(&tickslock);
+  while(!t->fired)
+    sleep(t, &tickslock);
+  release(&tickslock);
+}
+
+// Fire t now, if it is armed and has not fired yet.
+void
+timercancel(struct timer *t)
+{
+  acquire(&tickslock);
+  if(timerunhang(t)){
+    t->fired = 1;
+    wakeup(t);
+  }
+  release(&tickslock);
+}
+
+// Sleep for n clock ticks.
+// Returns -1 if killed first, else 0.
+int
+ticksleep(uint n)
+{
+  struct timer t;
+
+  if(n == 0)
+    return 0;
+
+  acquire(&tickslock);
+  t.expire = ticks + n;
+  t.when = 0;
+  return timerwait(&t);
+}
+
+// The CLINT's real-time counter, which counts
+// MTIMEFREQ times a second.
+uint64
+mtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
+// Sleep for ns nanoseconds, on an exact timer.
+// Returns -1 if killed first, else 0.
+int
+nanosleep(uint64 ns)
+{
+  struct timer t;
+  uint64 now;
+
+  acquire(&tickslock);
+  now = mtime();
+  t.when = now + ns / (1000000000 / MTIMEFREQ);
+  if(t.when <= now){
+    release(&tickslock);
+    return 0;
+  }
+  t.expire = t.when / TICKCYCLES + 1;
+  if(t.expire == ticks + 1 && (exactdue == 0 || t.when < exactdue)){
+    // due before the next tick: interrupt this CPU for it.
+    exactdue = t.when;
+    timerbusy();
+  }
+  return timerwait(&t);
+}
+
+// Stop this CPU's clock ticks until the first timer on the
+// wheel is due, but at most IDLETICKS ticks.
+// Called by an idle scheduler with interrupts off.
+void
+timeridle(void)
+{
+  struct timer *t;
+  uint64 now, next;
+  int i, n;
+
+  now = mtime() / TICKCYCLES;
+  n = IDLETICKS;
+  next = 0;
+  acquire(&tickslock);
+  for(i = 0; i < NWHEEL; i++){
+    for(t = wheel[i]; t; t = t->next){
+      if(t->when){
+        if(next == 0 || t->when < next)
+          next = t->when;
+      } else if((int)(t->expire - (uint)now) < n)
+        n = t->expire - (uint)now;
+    }
+  }
+  release(&tickslock);
+
+  if(n > 0 && (next == 0 || (now + n) * TICKCYCLES < next))
+    next = (now + n) * TICKCYCLES;
+  if(n <= 0 || next <= mtime())
+    timerkick(cpuid());
+  else
+    *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = next;
+}
+
+// Restart this CPU's clock ticks after timeridle(), or after
+// a clock interrupt, for which timervec has set the next one
+// a tick later, off the tick boundary if it was for an exact
+// timer. Called with interrupts off.
+void
+timerbusy(void)
+{
+  uint64 next, due;
+
+  next = (mtime() / TICKCYCLES + 1) * TICKCYCLES;
+  due = exactdue;
+  if(due && due < next)
+    next = due;
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = next;
+}
+
+// Make CPU id take a clock interrupt right away.
+void
+timerkick(int id)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(id) = mtime();
+}
@@ -0,0 +1,7 @@
+// A timer on the wheel in timer.c.
+struct timer {
+  uint expire;          // tick at which to wake
+  uint64 when;          // CLINT_MTIME at which to wake, if exact
+  int fired;
+  struct timer *next;   // wheel slot chain
+};
@@ -67,6 +67,20 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // instruction, load, or store page fault: copy-on-write,
+    // demand-zero heap, or program text not paged in yet.
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+
+    // paging in from the program file may sleep.
+    intr_on();
+
+    if(uvmfault(p->pagetable, stval, scause == 15) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,9 +90,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
@@ -150,9 +164,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,13 +174,34 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// advance ticks to the time on CLINT_MTIME, firing timers
+// for each tick passed, and any exact timers that are due.
+// any CPU may get here, and one that has been idle may have
+// missed many ticks.
 void
 clockintr()
 {
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
+  uint now;
+  int boost;
+
+  now = mtime() / TICKCYCLES;
+  boost = 0;
+  // nothing to do if another CPU got here first.
+  if(ticks != now || timerdue()){
+    acquire(&tickslock);
+    while((int)(now - ticks) > 0){
+      ticks++;
+      timertick();
+      if(ticks % BOOSTTICKS == 0)
+        boost = 1;
+    }
+    timerexact();
+    release(&tickslock);
+  }
+  timerbusy();
+
+  if(boost)
+    runqboost();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -205,9 +240,7 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    clockintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
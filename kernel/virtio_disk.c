@@ -212,12 +212,16 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// queue a request to read or write b's data from or to
+// disk block blockno, without waiting for it.
+// the device learns of it at the next notify.
+// caller holds vdisk_lock; may sleep for free descriptors,
+// after telling the device about any requests already queued
+// so that they can complete and free some.
+static void
+virtio_disk_queue(struct buf *b, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -229,6 +233,7 @@ virtio_disk_rw(struct buf *b, int write)
     if(alloc3_desc(idx) == 0) {
       break;
     }
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
@@ -277,20 +282,52 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+}
+
+// start reading or writing b and return without waiting.
+// the caller must hold b locked until virtio_disk_wait(b)
+// says the request has finished; it may start others meanwhile.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+  virtio_disk_queue(b, b->blockno, write);
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  release(&disk.vdisk_lock);
+}
 
+// start n requests as one group, with a single notify.
+// request i reads or writes b[i]'s data from or to block
+// blockno[i], or b[i]'s own block if blockno is 0.
+// wait for each with virtio_disk_wait().
+void
+virtio_disk_startv(struct buf **b, uint *blockno, int n, int write)
+{
+  acquire(&disk.vdisk_lock);
+  for(int i = 0; i < n; i++)
+    virtio_disk_queue(b[i], blockno ? blockno[i] : b[i]->blockno, write);
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  release(&disk.vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// wait for virtio_disk_intr() to say b's request has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +354,12 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
     wakeup(b);
+    if(b->ahead)
+      bdone(b);    // no one is waiting; release it
 
     disk.used_idx += 1;
   }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -33,6 +35,10 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, to read its real-time counter and
+  // reprogram the clock interrupts of CPUs.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -165,7 +171,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -178,9 +184,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -296,34 +302,32 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Writable pages are mapped read-only and marked
+// PTE_COW in both page tables; the first store to
+// such a page copies it (see uvmcow()).
 // returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// drops the child's references on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;  // never faulted in; the child will fault it in too.
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
@@ -332,6 +336,159 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Resolve a store to the copy-on-write page at va.
+// If this page table holds the only reference the page is
+// simply made writable again; otherwise it gets a private copy.
+// Returns 0 on success, -1 if va is not a copy-on-write page
+// or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Map a zero-filled page at va, for a heap page that
+// sbrk() reserved but nobody has touched yet.
+// Returns 0 on success, -1 if memory is exhausted.
+static int
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, PGROUNDDOWN(va), PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a page fault at user virtual address va, taken by the
+// current process (from usertrap()) or on its behalf (from
+// copyin()/copyout()). write is non-zero for stores.
+// May sleep to read the program file, but only for loads.
+// Returns 0 if the access can now be retried, -1 if it is illegal
+// or memory is exhausted.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct seg *s;
+  struct vma *v;
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return -1;
+  if(p && pagetable == p->pagetable && (v = vmalookup(p, va)) != 0)
+    return vmafault(pagetable, v, va, write);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    return -1;
+  }
+
+  // not mapped: part of the program image, or a
+  // heap page below p->sz that was never touched.
+  if(p == 0 || pagetable != p->pagetable || va >= p->sz)
+    return -1;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->vaddr && va < s->vaddr + s->memsz){
+      if(write && (s->perm & PTE_W) == 0)
+        return -1;
+      return loadpage(pagetable, p->exe, s, va);
+    }
+  }
+  return uvmlazy(pagetable, va);
+}
+
+// Fault in the pages covering [va, va+len) that a copyin()
+// would have to read from the program file or a mapped file,
+// for callers that copyin() or copyout() while holding a
+// spinlock, which cannot sleep, or an inode lock, which must
+// not be held while locking the file's inode.
+// Errors are left for the copyin() itself to report.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct seg *s;
+  struct vma *v;
+  uint64 a, end;
+  pte_t *pte;
+
+  if(p == 0 || pagetable != p->pagetable || va + len < va)
+    return;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    a = PGROUNDDOWN(va > s->vaddr ? va : s->vaddr);
+    end = s->vaddr + s->filesz;
+    if(va + len < end)
+      end = va + len;
+    for(; a < end; a += PGSIZE){
+      pte = walk(pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        uvmfault(pagetable, a, 0);
+    }
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || v->f == 0)
+      continue;
+    a = PGROUNDDOWN(va > v->addr ? va : v->addr);
+    end = v->addr + v->len;
+    if(va + len < end)
+      end = va + len;
+    for(; a < end; a += PGSIZE){
+      pte = walk(pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        uvmfault(pagetable, a, 0);
+    }
+  }
+}
+
+// Look up the user page at va like walkaddr(), faulting it in
+// first if the access (a store, if write) would fault.
+// Returns the physical address, or 0 if the access is illegal.
+static uint64
+uvmaccess(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+    if(uvmfault(pagetable, va, write) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -347,6 +504,8 @@ uvmclear(pagetable_t pagetable, uint64 va)
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Copy-on-write and untouched heap pages are faulted in first;
+// other read-only pages are refused.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
@@ -355,7 +514,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -380,7 +539,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -395,6 +554,39 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Copy from one user address space to another: len bytes
+// from srcva in pagetable src to dstva in pagetable dst.
+// Stops early, without faulting, at a destination page that
+// is not mapped writable, since dst may belong to another
+// process. Returns the number of bytes copied, or -1 if
+// reading the source fails.
+int
+copyuser(pagetable_t dst, uint64 dstva, pagetable_t src, uint64 srcva, uint64 len)
+{
+  uint64 n, va0, tot;
+  pte_t *pte;
+
+  tot = 0;
+  while(tot < len){
+    va0 = PGROUNDDOWN(dstva);
+    if(va0 >= MAXVA)
+      break;
+    pte = walk(dst, va0, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+      break;
+    n = PGSIZE - (dstva - va0);
+    if(n > len - tot)
+      n = len - tot;
+    if(copyin(src, (char *)(PTE2PA(*pte) + (dstva - va0)), srcva, n) < 0)
+      return -1;
+
+    tot += n;
+    srcva += n;
+    dstva = va0 + PGSIZE;
+  }
+  return tot;
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -407,7 +599,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
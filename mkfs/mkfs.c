@@ -39,7 +39,9 @@ void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint bindirect(uint *ap, uint bn);
 void iappend(uint inum, void *p, int n);
+void writedir(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +71,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum, nroot;
+  struct dirent *root;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -117,15 +118,15 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  nroot = argc;
+  root = calloc(nroot, sizeof(struct dirent));
+  if(root == 0)
+    die("calloc");
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  root[0].inum = xshort(rootino);
+  strcpy(root[0].name, ".");
+  root[1].inum = xshort(rootino);
+  strcpy(root[1].name, "..");
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -149,10 +150,8 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    root[i].inum = xshort(inum);
+    strncpy(root[i].name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +159,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  writedir(rootino, root, nroot);
 
   balloc(freeblock);
 
@@ -249,6 +243,25 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry bn of the indirect block whose address is
+// *ap, allocating the indirect block and the entry if needed.
+// The caller writes out the block holding *ap.
+uint
+bindirect(uint *ap, uint bn)
+{
+  uint indirect[NINDIRECT];
+
+  if(xint(*ap) == 0){
+    *ap = xint(freeblock++);
+  }
+  rsect(xint(*ap), (char*)indirect);
+  if(indirect[bn] == 0){
+    indirect[bn] = xint(freeblock++);
+    wsect(xint(*ap), (char*)indirect);
+  }
+  return xint(indirect[bn]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,8 +269,8 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint dindirect[NINDIRECT];
+  uint x, bn;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -270,16 +283,16 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = bindirect(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)dindirect);
+      bn = fbn - NDIRECT - NINDIRECT;
+      x = bindirect(&dindirect[bn / NINDIRECT], bn % NINDIRECT);
+      wsect(xint(din.addrs[NDIRECT+1]), (char*)dindirect);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -293,6 +306,64 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// FNV-1a, as in the kernel's dirhash().
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Write the n entries de as the contents of directory inum,
+// laid out as a hashed directory (see fs.h) with enough
+// buckets that the kernel need not split any yet.
+void
+writedir(uint inum, struct dirent *de, int n)
+{
+  uint nb, m, b, i, j;
+  char *blocks;
+  struct dirent *d;
+  struct dirhdr *hdr;
+
+  nb = (n + DIRLOAD - 1) / DIRLOAD;
+  if(nb == 0)
+    nb = 1;
+  for(m = 1; m * 2 <= nb; m *= 2)
+    ;
+  blocks = calloc(nb, BSIZE);
+  if(blocks == 0)
+    die("calloc");
+  for(b = 0; b < nb; b++){
+    hdr = (struct dirhdr*)(blocks + b * BSIZE);
+    hdr->magic = xint(DIRMAGIC);
+  }
+  ((struct dirhdr*)blocks)->nent = xint(n);
+
+  for(i = 0; i < n; i++){
+    b = dirhash(de[i].name) % (2 * m);
+    if(b >= nb)
+      b = dirhash(de[i].name) % m;
+    for(;;){
+      d = (struct dirent*)(blocks + b * BSIZE);
+      for(j = 1; j < DPB && d[j].inum != 0; j++)
+        ;
+      if(j < DPB)
+        break;
+      hdr = (struct dirhdr*)d;
+      hdr->flags = xshort(DIRH_OVERFLOW);
+      b = (b + 1) % nb;
+    }
+    d[j] = de[i];
+  }
+
+  iappend(inum, blocks, nb * BSIZE);
+  free(blocks);
+}
+
 void
 die(const char *s)
 {
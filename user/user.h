@@ -1,4 +1,6 @@
 struct stat;
+struct iovec;
+struct ring;
 
 // system calls
 int fork(void);
@@ -22,6 +24,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int setaffinity(int);
+int nanosleep(uint64);
+int splice(int, int, int);
+void* mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+struct ring* ringsetup(void);
+int ringenter(int);
+int getcpu(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
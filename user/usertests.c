@@ -4,6 +4,7 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/ring.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -578,6 +579,8 @@ writetest(char *s)
 void
 writebig(char *s)
 {
+  // far enough to need the double-indirect block.
+  enum { NBIG = NDIRECT + NINDIRECT + 300 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -586,7 +589,13 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  // a write that would go past MAXFILE fails, and writes nothing.
+  if(write(fd, buf, MAXFILE*BSIZE + 1) != -1){
+    printf("%s: error: write past MAXFILE succeeded\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +615,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -785,6 +794,430 @@ pipe1(char *s)
   }
 }
 
+// pipe more than its buffer holds, in writes and reads that
+// straddle the buffer's pages.
+void
+pipebig(char *s)
+{
+  int fds[2], pid, xstatus;
+  int i, n, total;
+  enum { TOTAL=3*PIPEPAGES*PGSIZE+123, WSZ=3001 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < TOTAL; total += n){
+      n = TOTAL - total < WSZ ? TOTAL - total : WSZ;
+      for(i = 0; i < n; i++)
+        buf[i] = (total + i) % 251;
+      if(write(fds[1], buf, n) != n){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 251){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  if(total != TOTAL){
+    printf("%s: read %d bytes, expected %d\n", s, total, TOTAL);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+// splice a file into a pipe and the pipe into another file.
+void
+splicetest(char *s)
+{
+  int fd, fds[2], pid, xstatus;
+  int i, n, total;
+  enum { TOTAL=3*BSIZE+77 };
+
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create splice1 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < TOTAL; i++)
+    buf[i] = i % 253;
+  if(write(fd, buf, TOTAL) != TOTAL){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "x", 1) != 1 || splice(fds[0], fds[1], 1) != -1){
+    printf("%s: splice of a pipe into itself succeeded\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 1) != 1){
+    printf("%s: pipe read failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice1", O_RDONLY);
+    if(splice(fd, fds[1], TOTAL + 100) != TOTAL){
+      printf("%s: splice to pipe failed\n", s);
+      exit(1);
+    }
+    if(splice(fd, fds[1], 100) != 0){
+      printf("%s: splice past end of file\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  fd = open("splice2", O_CREATE|O_RDWR);
+  total = 0;
+  while((n = splice(fds[0], fd, TOTAL)) > 0)
+    total += n;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(n < 0 || total != TOTAL){
+    printf("%s: spliced %d bytes from pipe\n", s, total);
+    exit(1);
+  }
+
+  fd = open("splice2", O_RDONLY);
+  memset(buf, 0, TOTAL);
+  if(read(fd, buf, sizeof(buf)) != TOTAL){
+    printf("%s: splice2 has the wrong size\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < TOTAL; i++){
+    if((buf[i] & 0xff) != i % 253){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splice1");
+  unlink("splice2");
+}
+
+// map files and anonymous memory, private and shared.
+void
+mmaptest(char *s)
+{
+  int fd, i, pid, xstatus;
+  char *p, *q;
+  enum { SZ=2*PGSIZE+100 };
+
+  fd = open("mmap1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmap1 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  // a private mapping reads the file, and zeros past its end.
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++){
+    if(p[i] != (i < SZ ? 'a' + i % 26 : 0)){
+      printf("%s: wrong byte %d in private mapping\n", s, i);
+      exit(1);
+    }
+  }
+  p[0] = 'X';
+  if(munmap(p, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // stores to a shared mapping reach the file, but do not
+  // grow it; unmapping the middle page leaves the others.
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[1] = 'Y';
+  p[SZ] = 'Z';
+  if(munmap(p + PGSIZE, PGSIZE) != 0){
+    printf("%s: munmap of middle page failed\n", s);
+    exit(1);
+  }
+  p[2*PGSIZE] = 'W';
+  if(munmap(p, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmap1", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != SZ){
+    printf("%s: mmap1 has the wrong size\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(buf[0] != 'a' || buf[1] != 'Y' || buf[2*PGSIZE] != 'W'){
+    printf("%s: shared stores did not reach the file\n", s);
+    exit(1);
+  }
+
+  // wait() stores the exit status into a file page that
+  // has not been read in yet.
+  fd = open("mmap1", O_RDWR);
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(7);
+  if(wait((int*)p) != pid || *(int*)p != 7){
+    printf("%s: wait into a file mapping failed\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmap1");
+
+  // private anonymous memory is copied on fork,
+  // shared anonymous memory is not.
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, -1, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, -1, 0);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  p[0] = q[0] = 1;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = q[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[0] != 1 || q[0] != 2){
+    printf("%s: anonymous mappings wrong after fork\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0 || munmap(q, PGSIZE) != 0){
+    printf("%s: munmap anonymous failed\n", s);
+    exit(1);
+  }
+}
+
+// readv/writev scatter and gather; pread/pwrite leave
+// the file offset alone.
+void
+iovtest(char *s)
+{
+  int fd, fds[2], i;
+  char a[10], b[5000], c[4];
+  struct iovec iov[3];
+
+  fd = open("iov1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iov1 failed\n", s);
+    exit(1);
+  }
+  memset(a, 'a', sizeof(a));
+  memset(b, 'b', sizeof(b));
+  memset(c, 'c', sizeof(c));
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = 3;
+  if(writev(fd, iov, 3) != sizeof(a) + sizeof(b) + 3){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  if(pwrite(fd, "xy", 2, 9) != 2 || pread(fd, c, 3, 8) != 3 ||
+     c[0] != 'a' || c[1] != 'x' || c[2] != 'y'){
+    printf("%s: pwrite/pread failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "z", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iov1", O_RDONLY);
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+  iov[2].iov_len = sizeof(c);
+  if(readv(fd, iov, 3) != sizeof(a) + sizeof(b) + sizeof(c)){
+    printf("%s: readv returned the wrong count\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < 9; i++)
+    if(a[i] != 'a')
+      break;
+  if(i != 9 || a[9] != 'x' || b[0] != 'y' || b[1] != 'b' ||
+     b[sizeof(b)-1] != 'b' || c[0] != 'c' || c[2] != 'c' || c[3] != 'z'){
+    printf("%s: readv read the wrong data\n", s);
+    exit(1);
+  }
+  unlink("iov1");
+
+  // like read(), readv() of a pipe returns what is there,
+  // rather than waiting to fill the later buffers.
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "pq", 2) != 2){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_len = 1;
+  if(readv(fds[0], iov, 3) != 1 || a[0] != 'p'){
+    printf("%s: readv of a pipe read past what was there\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// fsync() returns once the writes before it are committed.
+void
+fsynctest(char *s)
+{
+  int fd, i;
+
+  if(fsync(-1) != -1){
+    printf("%s: fsync(-1) succeeded\n", s);
+    exit(1);
+  }
+  fd = open("fsync1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsync1 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    if(write(fd, "0123456789", 10) != 10 || fsync(fd) != 0){
+      printf("%s: write or fsync failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("fsync1");
+}
+
+// queue several file operations on the syscall ring and
+// submit them with one ringenter().
+static struct sqe*
+ringsqe(struct ring *r, int op, int fd, void *addr, int n, uint off)
+{
+  struct sqe *e = &r->sq[r->sqtail % RINGSIZE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->off = off;
+  e->udata = r->sqtail;
+  r->sqtail++;
+  return e;
+}
+
+void
+ringtest(char *s)
+{
+  struct ring *r;
+  struct cqe *c;
+  char data[8];
+  int want[] = { 3, 4, 5, 0, -1 };
+  int fd, i;
+
+  r = ringsetup();
+  if(r == (struct ring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  if(ringsetup() != (struct ring*)-1){
+    printf("%s: second ringsetup succeeded\n", s);
+    exit(1);
+  }
+
+  ringsqe(r, RING_OPEN, 0, "ring1", O_CREATE|O_RDWR, 0);
+  if(ringenter(1) != 1 || r->cqtail != 1 || (fd = r->cq[0].res) < 0){
+    printf("%s: RING_OPEN failed\n", s);
+    exit(1);
+  }
+  r->cqhead++;
+
+  ringsqe(r, RING_WRITE, fd, "abc", 3, 0);
+  ringsqe(r, RING_WRITE, fd, "defg", 4, 0);
+  ringsqe(r, RING_PREAD, fd, data, sizeof(data), 2);
+  ringsqe(r, RING_CLOSE, fd, 0, 0, 0);
+  ringsqe(r, RING_READ, fd, data, 1, 0);
+  if(ringenter(100) != 5 || r->sqhead != r->sqtail || r->cqtail != 6){
+    printf("%s: ringenter did not run every entry\n", s);
+    exit(1);
+  }
+  for(i = 0; r->cqhead != r->cqtail; i++, r->cqhead++){
+    c = &r->cq[r->cqhead % RINGSIZE];
+    if(c->udata != r->cqhead || c->res != want[i]){
+      printf("%s: completion %d has result %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(memcmp(data, "cdefg", 5) != 0){
+    printf("%s: RING_PREAD read the wrong data\n", s);
+    exit(1);
+  }
+  unlink("ring1");
+}
 
 // test if child is killed (status = -1)
 void
@@ -1086,6 +1519,71 @@ mem(char *s)
   }
 }
 
+// fork shares memory copy-on-write. do parent and child
+// still see private copies once either of them writes,
+// including when the kernel writes with copyout()?
+void
+cowfork(char *s)
+{
+  enum { N = 256*4096 };
+  char *m;
+  int i, k, pid, xstatus, fds[2];
+
+  m = sbrk(N);
+  if(m == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  memset(m, 'a', N);
+
+  for(k = 0; k < 3; k++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      for(i = 0; i < N; i += 4096)
+        m[i] = 'b' + k;
+      if(read(fds[0], m + N - 4096, 4096) != 4096)
+        exit(1);
+      for(i = 0; i < N - 4096; i += 4096){
+        if(m[i] != 'b' + k || m[i+1] != 'a'){
+          printf("%s: child sees wrong data\n", s);
+          exit(1);
+        }
+      }
+      if(m[N-4096] != 'z' || m[N-1] != 'z'){
+        printf("%s: read into copy-on-write page failed\n", s);
+        exit(1);
+      }
+      exit(0);
+    }
+    close(fds[0]);
+    memset(buf, 'z', 4096);
+    if(write(fds[1], buf, 4096) != 4096){
+      printf("%s: pipe write failed\n", s);
+      exit(1);
+    }
+    close(fds[1]);
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+    for(i = 0; i < N; i++){
+      if(m[i] != 'a'){
+        printf("%s: parent memory changed by child\n", s);
+        exit(1);
+      }
+    }
+  }
+  sbrk(-N);
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1778,6 +2276,57 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// two descriptors reading one file in interleaved order, so
+// that read-ahead sees sequential and non-sequential access,
+// must both see the right data.
+void
+readahead(char *s)
+{
+  enum { N = 64 };
+  int fd, fd1, fd2, i, j;
+  char b1[BSIZE], b2[BSIZE];
+
+  unlink("ra.dat");
+  fd = open("ra.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create ra.dat\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write ra.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd1 = open("ra.dat", O_RDONLY);
+  fd2 = open("ra.dat", O_RDONLY);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: cannot open ra.dat\n", s);
+    exit(1);
+  }
+  // fd2 skips ahead half the file.
+  for(i = 0; i < N/2; i++)
+    read(fd2, b2, BSIZE);
+  for(i = 0; i < N/2; i++){
+    if(read(fd1, b1, BSIZE) != BSIZE || read(fd2, b2, BSIZE) != BSIZE){
+      printf("%s: read ra.dat failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < BSIZE; j++){
+      if(b1[j] != i || b2[j] != i + N/2){
+        printf("%s: read ra.dat wrong data\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(fd1);
+  close(fd2);
+  unlink("ra.dat");
+}
+
 void
 fourteen(char *s)
 {
@@ -2117,6 +2666,185 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() only reserves address space. can a process grow
+// beyond physical memory, touch a few pages, and hand
+// untouched pages to system calls?
+void
+sbrklazy(char *s)
+{
+  enum { BIG=1024*1024*1024 };
+  char *a, *p;
+  int fd;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += 64*1024*1024){
+    if(*p != 0){
+      printf("%s: fresh heap page not zero\n", s);
+      exit(1);
+    }
+    *p = 'x';
+  }
+
+  // kernel writes to an untouched page.
+  fd = open("README", 0);
+  if(fd < 0){
+    printf("%s: open(README) failed\n", s);
+    exit(1);
+  }
+  p = a + BIG - 2*PGSIZE;
+  if(read(fd, p, 10) != 10){
+    printf("%s: read into untouched page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // kernel reads from an untouched page.
+  fd = open("sbrklazy", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: open(sbrklazy) failed\n", s);
+    exit(1);
+  }
+  if(write(fd, a + BIG/2 + PGSIZE, 10) != 10){
+    printf("%s: write from untouched page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sbrklazy");
+
+  if(sbrk(-BIG) != a + BIG){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
+// hold more distinct inodes open at once than the
+// kernel's inode table used to have room for.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 8, NF = 10 };
+  int ready[2], done[2], i, j, pid, fd, xstatus;
+  char name[8], c;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(done[1]);
+      name[0] = 'm'; name[1] = 'i'; name[2] = '0' + i; name[4] = '\0';
+      for(j = 0; j < NF; j++){
+        name[3] = 'a' + j;
+        if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        unlink(name);
+      }
+      write(ready[1], "x", 1);
+      read(done[0], &c, 1);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(done[1]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  close(ready[0]);
+  close(ready[1]);
+  close(done[0]);
+}
+
+// processes pinned to one CPU must all still run.
+void
+affinity(char *s)
+{
+  enum { N = 4 };
+  int i, j, id, pid, xstatus;
+  volatile int x;
+
+  if(setaffinity(0) != -1){
+    printf("%s: setaffinity(0) succeeded\n", s);
+    exit(1);
+  }
+  // children pinned to CPUs 0 and 1 must only ever run there,
+  // across sleeps and preemption.
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      id = i % 2;
+      if(setaffinity(1 << id) != 0){
+        if(id == 0){
+          printf("%s: setaffinity(1) failed\n", s);
+          exit(1);
+        }
+        exit(0);  // CPU 1 is not running
+      }
+      for(j = 0; j < 100; j++){
+        if(getcpu() != id){
+          printf("%s: pinned to CPU %d but ran on %d\n", s, id, getcpu());
+          exit(1);
+        }
+        if(j % 10 == 0)
+          sleep(1);
+        for(x = 0; x < 100000; x++)
+          ;
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < N; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// nanosleep() should sleep about as long as asked, whether
+// less or more than a clock tick.
+void
+nanosleeptest(char *s)
+{
+  int t0, t1;
+
+  if(nanosleep(0) != 0 || nanosleep(1000) != 0){
+    printf("%s: short nanosleep failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if(nanosleep(300000000ULL) != 0){  // 0.3 seconds
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  t1 = uptime();
+  if(t1 - t0 < HZ / 5){
+    printf("%s: nanosleep returned after %d ticks\n", s, t1 - t0);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2594,6 +3322,12 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipebig, "pipebig"},
+  {splicetest, "splice"},
+  {mmaptest, "mmap"},
+  {iovtest, "iov"},
+  {ringtest, "ring"},
+  {fsynctest, "fsync"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2603,6 +3337,7 @@ struct test {
   {forkforkfork, "forkforkfork"},
   {reparent2, "reparent2"},
   {mem, "mem"},
+  {cowfork, "cowfork"},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
@@ -2613,6 +3348,7 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {readahead, "readahead"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
@@ -2620,6 +3356,10 @@ struct test {
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {sbrklazy, "sbrklazy"},
+  {manyinodes, "manyinodes"},
+  {affinity, "affinity"},
+  {nanosleeptest, "nanosleep"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -2684,6 +3424,209 @@ bigdir(char *s)
   }
 }
 
+// a directory big enough to split its hash buckets
+// several times must still find every name, before
+// and after half of them are removed.
+void
+hashdir(char *s)
+{
+  enum { N = 400 };
+  int i, fd;
+  char name[8];
+
+  if(mkdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  // links, since the file system has fewer than N inodes.
+  if((fd = open("hd0", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create hd0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  name[0] = 'h'; name[1] = 'd'; name[2] = '/'; name[5] = '\0';
+  for(i = 0; i < N; i++){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    if(link("hd0", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlink non-empty hd succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i += 2){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    fd = open(name, O_RDONLY);
+    if((i % 2 == 0) != (fd < 0)){
+      printf("%s: open %s gave %d\n", s, name, fd);
+      exit(1);
+    }
+    if(fd >= 0){
+      close(fd);
+      unlink(name);
+    }
+  }
+  if(unlink("hd") != 0 || unlink("hd0") != 0){
+    printf("%s: unlink empty hd failed\n", s);
+    exit(1);
+  }
+}
+
+// links whose names all hash to bucket 0 until the directory
+// has 17 buckets, so that the 17th bucket's split must drain a
+// long overflow run, more blocks than one transaction may log.
+void
+hashrun(char *s)
+{
+  enum { N = 800 };
+  static char names[N][8];
+  uint h, k;
+  int i, j, fd;
+  char *p;
+
+  if(mkdir("hr") != 0){
+    printf("%s: mkdir hr failed\n", s);
+    exit(1);
+  }
+  if((fd = open("hr0", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create hr0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0, k = 0; i < N; k++){
+    p = names[i];
+    p[0] = 'h'; p[1] = 'r'; p[2] = '/';
+    p[3] = 'a' + k % 26;
+    p[4] = 'a' + k / 26 % 26;
+    p[5] = 'a' + k / 676 % 26;
+    p[6] = '\0';
+    h = 2166136261;
+    for(j = 3; p[j]; j++)
+      h = (h ^ (uchar)p[j]) * 16777619;
+    if(h % 16 == 0)
+      i++;
+  }
+  for(i = 0; i < N; i++){
+    if(link("hr0", names[i]) != 0){
+      printf("%s: link %s failed\n", s, names[i]);
+      exit(1);
+    }
+    // names must still be found while a split is under way.
+    for(j = i % 29; j <= i; j += 29){
+      if((fd = open(names[j], O_RDONLY)) < 0){
+        printf("%s: open %s failed\n", s, names[j]);
+        exit(1);
+      }
+      close(fd);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(unlink(names[i]) != 0){
+      printf("%s: unlink %s failed\n", s, names[i]);
+      exit(1);
+    }
+  }
+  if(unlink("hr") != 0 || unlink("hr0") != 0){
+    printf("%s: unlink hr failed\n", s);
+    exit(1);
+  }
+}
+
+// the dentry cache must follow creates, unlinks, and the
+// entries a hashed directory's split moves to new offsets.
+void
+dcachetest(char *s)
+{
+  enum { N = 50 };   // with . and .., past DIRLOAD, and one more
+  int i, fd;
+  char name[6];
+
+  if(mkdir("dc") != 0){
+    printf("%s: mkdir dc failed\n", s);
+    exit(1);
+  }
+  if(open("dc/x", O_RDONLY) >= 0){
+    printf("%s: open of missing dc/x succeeded\n", s);
+    exit(1);
+  }
+  if((fd = open("dc/x", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create dc/x failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dc/x", O_RDONLY)) < 0){
+    printf("%s: open of created dc/x failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dc/x") != 0){
+    printf("%s: unlink dc/x failed\n", s);
+    exit(1);
+  }
+  if(open("dc/x", O_RDONLY) >= 0){
+    printf("%s: open of unlinked dc/x succeeded\n", s);
+    exit(1);
+  }
+
+  // cache each name as it is linked. the link that takes dc
+  // past DIRLOAD entries adds bucket 1, and the next one
+  // drains part of bucket 0 into it.
+  if((fd = open("dc0", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create dc0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  name[0] = 'd'; name[1] = 'c'; name[2] = '/'; name[5] = '\0';
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(link("dc0", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s after split failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+    if(open(name, O_RDONLY) >= 0){
+      printf("%s: open of unlinked %s succeeded\n", s, name);
+      exit(1);
+    }
+  }
+  // a stale offset would have unlinked the wrong slot,
+  // leaving dc non-empty.
+  if(unlink("dc") != 0 || unlink("dc0") != 0){
+    printf("%s: unlink dc failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2926,6 +3869,9 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {hashdir, "hashdir"},
+  {hashrun, "hashrun"},
+  {dcachetest, "dcache"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
@@ -36,3 +36,16 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("fsync");
+entry("setaffinity");
+entry("nanosleep");
+entry("splice");
+entry("mmap");
+entry("munmap");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("ringsetup");
+entry("ringenter");
+entry("getcpu");